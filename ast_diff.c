@@ -2,7 +2,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <assert.h>
+#include <pthread.h>
+#include "mapfile.h"
+#include "par_sort.h"
 
 /* Given the names of two files of MPC astrometry on the command
 line,  this determines which objects are in each file,  then figures
@@ -23,7 +27,37 @@ we're concerned about;  as noted,  we don't really care if the
 reference code has changed.)  Then we do the same thing for the
 second file.  The two lists are compared to determine objects
 that have changed;  finally,  we read through the second file
-again,  outputting only the data for the selected objects.  */
+again,  outputting only the data for the selected objects.
+
+   The files are memory-mapped and cut (at line boundaries) into one
+chunk per thread;  each thread builds its own table of objects,  and the
+tables are then merged.  Since an object's hash is just the XOR of the
+hashes of its lines,  it doesn't matter which thread saw which lines.
+By default,  one thread per processor is used;  '-j N' sets the number
+of threads.
+
+   Usually,  the 'before' file is just yesterday's 'after' file.  To
+avoid hashing it all over again,  '-s (filename)' saves the table of
+objects (packed ID,  hash,  and number of observations) found in the
+'after' file as a binary snapshot.  Give that snapshot as the 'before'
+file on the next run;  it's recognized by its first eight bytes.  So a
+daily run might be
+
+ast_diff yesterday.snp UnnObs.txt changed.txt -s today.snp
+
+   The snapshot is in native byte order,  and 'long' hashes are stored
+as 64 bits;  it's meant to be read back on the machine that made it.
+
+   With '-d',  the output file gets only the differences for changed
+objects,  rather than all of their lines.  Each line in a changed object
+is hashed on its own;  lines from the 'before' file that have no match in
+the 'after' file are written out preceded by '-',  and unmatched 'after'
+lines by '+'.  (Again,  lines differing only in,  say,  the reference are
+considered to match.)  Objects are listed in order of packed ID,  with
+removals before additions and lines in file order within each.  Objects
+that vanished entirely from the 'after' file show up as removals.  This
+needs the actual lines of the 'before' file,  so it can't be used with
+a snapshot.  */
 
 #define is_power_of_two( X)   (!((X) & ((X) - 1)))
 
@@ -31,90 +65,422 @@ typedef struct
 {
    char packed[12];
    long hash;
+   unsigned n_obs;
+   int is_changed;
 } obj_t;
 
-static long hash_80_column_astrometry( const char *buff)
+/* Objects are kept in an open-addressing hash table keyed on the
+12-byte packed ID.  'objs' holds the objects in the order in which they
+were first seen;  'slots' is the hash table proper,  holding indices
+into 'objs' plus one (zero meaning 'empty').  It's kept at most half
+full,  and doubled in size when it gets that far.   */
+
+typedef struct
+{
+   obj_t *objs;
+   unsigned *slots;
+   unsigned n_objs, table_size;
+} obj_table_t;
+
+/* Only some columns of the astrometry are hashed : the date,  RA/dec,
+magnitude and band,  and MPC code.  Those are the columns that aren't
+blank in 'template' below.  Columns 1-15 (the packed ID,  discovery
+asterisk,  and notes) are blank there,  and aren't hashed.  Rather than
+check the template for each column of each line,  we list those columns
+once. */
+
+static int mask_positions[80], n_mask_positions = 0;
+
+static void init_mask_positions( void)
 {
-   const long prime = 314159257;
-   long rval = 42;
-   size_t i;
    const char *template =
                "               2022_11_24.23624418_37_12.050"
                "+76_45_16.88         19.14oV     T05";
+   int i;
 
-   for( i = 0; i < 80; i++)
+   for( i = 0; i < 80 && template[i]; i++)
       if( template[i] != ' ')
-         rval = (rval * prime) ^ buff[i];
+         mask_positions[n_mask_positions++] = i;
+}
+
+static long hash_80_column_astrometry( const char *buff)
+{
+   const long prime = 314159257;
+   long rval = 42;
+   int i;
+
+   for( i = 0; i < n_mask_positions; i++)
+      rval = (rval * prime) ^ buff[mask_positions[i]];
    return( rval);
 }
 
-int obj_compare( const void *a, const void *b)
+static unsigned hash_packed( const char *packed)
 {
-   return( memcmp( a, b, 12));
+   unsigned rval = 2166136261u;     /* FNV-1a */
+   size_t i;
+
+   for( i = 0; i < 12; i++)
+      rval = (rval ^ (unsigned char)packed[i]) * 16777619u;
+   return( rval);
 }
 
-/* In most files,  the observations are at least approximately sorted by
-packed ID.  In some,  there is a bit of disorder.  So we look back by
-ten objects to see if maybe this is something we've looked at recently.
+/* Returns the slot where 'packed' is,  or the empty slot where it
+should go. */
+
+static unsigned *find_slot( const obj_table_t *table, const char *packed)
+{
+   const unsigned mask = table->table_size - 1;
+   unsigned loc = hash_packed( packed) & mask;
 
-This will sometimes fail,  because the actual object was eleven or more
-objects back,  and we'll have an erroneously duplicated object.  So
-after sorting by packed ID,  we do a final pass to look for such
-duplicates (now adjacent in the array) and eliminate them.  The hash
-value is the XORed result of the hashes for each line,  so re-ordering
-of lines won't affect the final result.  It also means that when we
-eliminate duplicates,  XORing the hashes from them gets us the right
-answer,  just as if the file had been completely sorted. */
+   while( table->slots[loc]
+            && memcmp( table->objs[table->slots[loc] - 1].packed, packed, 12))
+      loc = (loc + 1) & mask;
+   return( table->slots + loc);
+}
+
+static obj_t *find_object( const obj_table_t *table, const char *packed)
+{
+   const unsigned idx = *find_slot( table, packed);
+
+   return( idx ? table->objs + idx - 1 : NULL);
+}
 
-static obj_t *find_objects_in_file( FILE *ifile, unsigned *n_found)
+static void init_table( obj_table_t *table)
 {
-   obj_t *rval = NULL;
-   unsigned n = 0, i, j;
-   char buff[90];
-   const unsigned lookback = 10;
+   table->n_objs = 0;
+   table->table_size = 1024;
+   table->slots = (unsigned *)calloc( table->table_size, sizeof( unsigned));
+   table->objs = (obj_t *)malloc( table->table_size / 2 * sizeof( obj_t));
+   assert( table->slots && table->objs);
+}
+
+static void free_table( obj_table_t *table)
+{
+   free( table->slots);
+   free( table->objs);
+}
+
+static obj_t *find_or_add_object( obj_table_t *table, const char *packed)
+{
+   unsigned *slot = find_slot( table, packed);
+   obj_t *obj;
+
+   if( *slot)
+      return( table->objs + *slot - 1);
+   if( (table->n_objs + 1) * 2 > table->table_size)
+      {           /* table is half full;  double it and re-hash */
+      unsigned i;
+
+      table->table_size *= 2;
+      free( table->slots);
+      table->slots = (unsigned *)calloc( table->table_size, sizeof( unsigned));
+      table->objs = (obj_t *)realloc( table->objs,
+                           table->table_size / 2 * sizeof( obj_t));
+      assert( table->slots && table->objs);
+      for( i = 0; i < table->n_objs; i++)
+         *find_slot( table, table->objs[i].packed) = i + 1;
+      slot = find_slot( table, packed);
+      }
+   obj = table->objs + table->n_objs++;
+   *slot = table->n_objs;
+   memcpy( obj->packed, packed, 12);
+   obj->hash = 0;
+   obj->n_obs = 0;
+   obj->is_changed = 0;
+   return( obj);
+}
 
-   while( fgets( buff, sizeof( buff), ifile))
-      if( strlen( buff) == 81)
+/* The hash for each object is the XORed result of the hashes for each
+line,  so the order in which lines appear (and whether an object's
+lines are all together) doesn't affect the result.  Only lines of
+exactly 80 columns (plus line feed) are considered.  */
+
+typedef struct
+{
+   const char *data;
+   size_t start, end;
+   obj_table_t table;
+} chunk_t;
+
+static size_t next_line( const char *data, const size_t len, const size_t loc)
+{
+   const char *tptr = (const char *)memchr( data + loc, '\n', len - loc);
+
+   return( tptr ? (size_t)( tptr - data) + 1 : len);
+}
+
+static void *hash_chunk( void *context)
+{
+   chunk_t *c = (chunk_t *)context;
+   obj_t *obj = NULL;
+   size_t loc = c->start;
+
+   init_table( &c->table);
+   while( loc < c->end)
+      {
+      const size_t next = next_line( c->data, c->end, loc);
+      const char *buff = c->data + loc;
+
+      if( next - loc == 81 && buff[80] == '\n')
+         {
+         if( !obj || memcmp( obj->packed, buff, 12))
+            obj = find_or_add_object( &c->table, buff);
+         obj->hash ^= hash_80_column_astrometry( buff);
+         obj->n_obs++;
+         }
+      loc = next;
+      }
+   return( NULL);
+}
+
+static void find_objects_in_file( const mapped_file_t *mf, obj_table_t *table,
+                        const int n_threads)
+{
+   chunk_t *chunks = (chunk_t *)calloc( n_threads, sizeof( chunk_t));
+   pthread_t *threads = (pthread_t *)calloc( n_threads, sizeof( pthread_t));
+   char *started = (char *)calloc( n_threads, 1);
+   int i;
+   unsigned j;
+
+   assert( chunks && threads && started);
+   for( i = 0; i < n_threads; i++)
+      {
+      chunks[i].data = mf->data;
+      chunks[i].end = mf->len;
+      if( i)
          {
-         unsigned loc = n;
+         chunks[i].start = mf->len * (size_t)i / (size_t)n_threads;
+         if( chunks[i].start < chunks[i - 1].start)
+            chunks[i].start = chunks[i - 1].start;
+         else if( chunks[i].start && mf->data[chunks[i].start - 1] != '\n')
+            chunks[i].start = next_line( mf->data, mf->len, chunks[i].start);
+         chunks[i - 1].end = chunks[i].start;
+         }
+      }
+   for( i = 1; i < n_threads; i++)
+      started[i] = !pthread_create( threads + i, NULL, hash_chunk, chunks + i);
+   for( i = 0; i < n_threads; i++)
+      if( !started[i])
+         hash_chunk( chunks + i);
+   *table = chunks[0].table;
+   for( i = 1; i < n_threads; i++)
+      {
+      if( started[i])
+         pthread_join( threads[i], NULL);
+      for( j = 0; j < chunks[i].table.n_objs; j++)
+         {
+         const obj_t *obj = chunks[i].table.objs + j;
+         obj_t *merged = find_or_add_object( table, obj->packed);
+
+         merged->hash ^= obj->hash;
+         merged->n_obs += obj->n_obs;
+         }
+      free_table( &chunks[i].table);
+      }
+   free( chunks);
+   free( threads);
+   free( started);
+   assert( table->n_objs);    /* we must've gotten at least _one_ object */
+}
+
+#define SNAPSHOT_MAGIC "ASTDIFF1"
+
+typedef struct
+{
+   char packed[12];
+   uint32_t n_obs;
+   int64_t hash;
+} snapshot_obj_t;
+
+static int write_snapshot( const obj_table_t *table, const char *filename)
+{
+   FILE *ofile = fopen( filename, "wb");
+   const uint32_t n_objs = (uint32_t)table->n_objs;
+   unsigned i;
+
+   if( !ofile)
+      return( -1);
+   fwrite( SNAPSHOT_MAGIC, 8, 1, ofile);
+   fwrite( &n_objs, sizeof( n_objs), 1, ofile);
+   for( i = 0; i < table->n_objs; i++)
+      {
+      snapshot_obj_t sobj;
+
+      memcpy( sobj.packed, table->objs[i].packed, 12);
+      sobj.n_obs = (uint32_t)table->objs[i].n_obs;
+      sobj.hash = (int64_t)table->objs[i].hash;
+      fwrite( &sobj, sizeof( sobj), 1, ofile);
+      }
+   return( fclose( ofile));
+}
 
-         while( loc && loc + lookback > n && memcmp( buff, rval[loc - 1].packed, 12))
-            loc--;
-         if( loc + lookback <= n)
-            loc = 0;
-         if( !loc)      /* didn't find it */
+static int is_snapshot( const mapped_file_t *mf)
+{
+   return( mf->len >= 8 && !memcmp( mf->data, SNAPSHOT_MAGIC, 8));
+}
+
+static int load_snapshot( const mapped_file_t *mf, obj_table_t *table)
+{
+   const size_t header_size = 8 + sizeof( uint32_t);
+   uint32_t n_objs, i;
+
+   if( mf->len < header_size)
+      return( -1);
+   memcpy( &n_objs, mf->data + 8, sizeof( uint32_t));
+   if( mf->len != header_size + n_objs * sizeof( snapshot_obj_t))
+      return( -1);
+   init_table( table);
+   for( i = 0; i < n_objs; i++)
+      {
+      snapshot_obj_t sobj;
+      obj_t *obj;
+
+      memcpy( &sobj, mf->data + header_size + i * sizeof( snapshot_obj_t),
+                           sizeof( snapshot_obj_t));
+      obj = find_or_add_object( table, sobj.packed);
+      obj->hash ^= (long)sobj.hash;
+      obj->n_obs += sobj.n_obs;
+      }
+   return( 0);
+}
+
+/* For '-d' output,  a list of the lines in changed objects.  */
+
+typedef struct
+{
+   const char *line;
+   long hash;
+   char sign;           /* '-' for 'before' lines,  '+' for 'after' */
+   char is_matched;
+} delta_rec_t;
+
+static size_t collect_changed_lines( const mapped_file_t *mf,
+            const obj_table_t *table, const char sign,
+            delta_rec_t **recs, size_t n_recs)
+{
+   size_t loc = 0;
+   const obj_t *obj = NULL;
+
+   while( loc < mf->len)
+      {
+      const size_t next = next_line( mf->data, mf->len, loc);
+      const char *line = mf->data + loc;
+
+      if( next - loc == 81 && line[80] == '\n')
+         {
+         if( !obj || memcmp( obj->packed, line, 12))
+            obj = find_object( table, line);
+         if( obj && obj->is_changed)
             {
-            loc = n;
-            n++;
-            if( is_power_of_two( n))
-               rval = (obj_t *)realloc( rval, 2 * n * sizeof( obj_t));
-            memcpy( rval[loc].packed, buff, 12);
-            rval[loc].hash = 0;
+            delta_rec_t *rec;
+
+            n_recs++;
+            if( is_power_of_two( n_recs))
+               *recs = (delta_rec_t *)realloc( *recs,
+                              2 * n_recs * sizeof( delta_rec_t));
+            assert( *recs);
+            rec = *recs + n_recs - 1;
+            rec->line = line;
+            rec->hash = hash_80_column_astrometry( line);
+            rec->sign = sign;
+            rec->is_matched = 0;
             }
-         else
-            loc--;
-         rval[loc].hash ^= hash_80_column_astrometry( buff);
          }
-   assert( n);       /* we must've gotten at least _one_ object */
-   qsort( rval, n, sizeof( obj_t), obj_compare);
-   for( i = j = 1; i < n; i++)
-      if( memcmp( rval[i - 1].packed, rval[i].packed, 12))
-         rval[j++] = rval[i];
-      else
-         rval[j - 1].hash ^= rval[i].hash;
-   n = j;
-// for( i = 0; i < n; i++)
-//    printf( "%.12s %lx\n", rval[i].packed, (unsigned long)rval[i].hash);
-   *n_found = n;
+      loc = next;
+      }
+   return( n_recs);
+}
+
+/* Sorting by packed ID,  then hash,  brings matching 'before' and
+'after' lines together.  Within the same file,  ties are broken by
+position,  so that the output is in file order. */
+
+static int delta_match_compare( const void *a, const void *b)
+{
+   const delta_rec_t *rec1 = (const delta_rec_t *)a;
+   const delta_rec_t *rec2 = (const delta_rec_t *)b;
+   int rval = memcmp( rec1->line, rec2->line, 12);
+
+   if( !rval && rec1->hash != rec2->hash)
+      rval = (rec1->hash < rec2->hash ? -1 : 1);
+   if( !rval)
+      rval = rec1->sign - rec2->sign;     /* '+' sorts before '-' */
+   if( !rval && rec1->line != rec2->line)
+      rval = (rec1->line < rec2->line ? -1 : 1);
    return( rval);
 }
 
+static int delta_output_compare( const void *a, const void *b)
+{
+   const delta_rec_t *rec1 = (const delta_rec_t *)a;
+   const delta_rec_t *rec2 = (const delta_rec_t *)b;
+   int rval = memcmp( rec1->line, rec2->line, 12);
+
+   if( !rval)
+      rval = rec2->sign - rec1->sign;     /* '-' lines first */
+   if( !rval && rec1->line != rec2->line)
+      rval = (rec1->line < rec2->line ? -1 : 1);
+   return( rval);
+}
+
+static void write_delta( FILE *ofile, const mapped_file_t *before,
+            const obj_table_t *obj_bef, const mapped_file_t *after,
+            const obj_table_t *obj_aft, const bool is_nsd_obs)
+{
+   delta_rec_t *recs = NULL;
+   size_t n_recs = 0, i, j;
+
+   n_recs = collect_changed_lines( before, obj_bef, '-', &recs, n_recs);
+   n_recs = collect_changed_lines( after, obj_aft, '+', &recs, n_recs);
+   qsort( recs, n_recs, sizeof( delta_rec_t), delta_match_compare);
+   for( i = 0; i < n_recs; i = j)
+      {           /* pair off '+' and '-' lines within a run of matches */
+      size_t n_plus = 0, n_pairs, k;
+
+      for( j = i; j < n_recs && !memcmp( recs[i].line, recs[j].line, 12)
+                             && recs[i].hash == recs[j].hash; j++)
+         if( recs[j].sign == '+')
+            n_plus++;
+      n_pairs = (n_plus < j - i - n_plus ? n_plus : j - i - n_plus);
+      for( k = 0; k < n_pairs; k++)
+         {              /* the '+' lines come first,  then the '-' ones */
+         recs[i + k].is_matched = 1;
+         recs[i + n_plus + k].is_matched = 1;
+         }
+      }
+   for( i = j = 0; i < n_recs; i++)
+      if( !recs[i].is_matched)
+         recs[j++] = recs[i];
+   n_recs = j;
+   qsort( recs, n_recs, sizeof( delta_rec_t), delta_output_compare);
+   for( i = 0; i < n_recs; i++)
+      {
+      char buff[81];
+
+      memcpy( buff, recs[i].line, 80);
+      buff[80] = '\0';
+      if( is_nsd_obs && recs[i].sign == '+')
+         buff[72] = '!';      /* mark obs as 'do not distribute' */
+      fprintf( ofile, "%c%s\n", recs[i].sign, buff);
+      }
+   free( recs);
+}
+
+static int obj_ptr_compare( const void *a, const void *b)
+{
+   return( memcmp( (*(const obj_t * const *)a)->packed,
+                   (*(const obj_t * const *)b)->packed, 12));
+}
+
 int main( const int argc, const char **argv)
 {
-   FILE *before, *after;
-   obj_t *obj_bef, *obj_aft;
-   unsigned n_bef, n_aft, i, j;
-   bool is_nsd_obs;
+   mapped_file_t before, after;
+   obj_table_t obj_bef, obj_aft;
+   obj_t **changed;
+   unsigned n_changed = 0, i;
+   int n_threads = n_cpus_available( );
+   const char *output_filename = NULL, *snapshot_filename = NULL;
+   bool is_nsd_obs, show_delta = false;
 
    if( argc < 3)
       {
@@ -124,65 +490,138 @@ int main( const int argc, const char **argv)
          "have been updated.  (Irrelevancies such as reference changes are\n"
          "ignored.)  The astrometry for objects in the second file that didn't\n"
          "exist in the first,  or were changed,  is output to stdout (or\n"
-         "to the filename specified by a third command line argument.)\n");
+         "to the filename specified by a third command line argument.)\n"
+         "'-j N' sets the number of threads used (default is one per CPU).\n"
+         "'-s (file)' saves a snapshot of the second file's objects,  which\n"
+         "can be given in place of the first file on a later run.\n"
+         "'-d' writes only added ('+') and removed ('-') lines of changed\n"
+         "objects to the output file.\n");
       return( -1);
       }
-   before = fopen( argv[1], "rb");
-   assert( before);
-   obj_bef = find_objects_in_file( before, &n_bef);
-   fclose( before);
-
-   after = fopen( argv[2], "rb");
-   assert( after);
-   obj_aft = find_objects_in_file( before, &n_aft);
-
-   for( i = j = 0; i < n_aft; i++)
-      {
-      int compare = -1;
-
-      while( j < n_bef && (compare = memcmp( obj_aft[i].packed, obj_bef[j].packed, 12)) > 0)
-         j++;
-      if( compare)
-         printf( "%.12s wasn't in %s\n", obj_aft[i].packed, argv[1]);
-      else if( obj_aft[i].hash != obj_bef[j].hash)
-         printf( "%.12s changed\n", obj_aft[i].packed);
-      else        /* no change;  mark for removal from list */
-         obj_aft[i].packed[0] = '\0';
-      }
-   free( obj_bef);
-   for( i = j = 0; i < n_aft; i++)
-      if( obj_aft[i].packed[0])
-         obj_aft[j++] = obj_aft[i];
-   n_aft = j;
-   printf( "%u objects have changed\n", n_aft);
+   for( i = 3; i < (unsigned)argc; i++)
+      if( argv[i][0] != '-')
+         {
+         if( i == 3)
+            output_filename = argv[i];
+         }
+      else if( argv[i][1] == 'j')
+         n_threads = atoi( argv[i][2] || i == (unsigned)argc - 1 ?
+                                 argv[i] + 2 : argv[++i]);
+      else if( argv[i][1] == 'd')
+         show_delta = true;
+      else if( argv[i][1] == 's')
+         snapshot_filename = (argv[i][2] || i == (unsigned)argc - 1 ?
+                                 argv[i] + 2 : argv[++i]);
+   if( n_threads < 1)
+      n_threads = 1;
+   init_mask_positions( );
+   if( map_file( &before, argv[1], 0))
+      {
+      perror( argv[1]);
+      return( -1);
+      }
+   if( !is_snapshot( &before))
+      find_objects_in_file( &before, &obj_bef, n_threads);
+   else if( show_delta)
+      {
+      fprintf( stderr, "'-d' needs the actual lines of '%s',  not a snapshot\n",
+                     argv[1]);
+      return( -1);
+      }
+   else if( load_snapshot( &before, &obj_bef))
+      {
+      fprintf( stderr, "Snapshot '%s' is corrupted\n", argv[1]);
+      return( -1);
+      }
+
+   if( map_file( &after, argv[2], 0))
+      {
+      perror( argv[2]);
+      return( -1);
+      }
+   find_objects_in_file( &after, &obj_aft, n_threads);
+   if( snapshot_filename && write_snapshot( &obj_aft, snapshot_filename))
+      {
+      perror( snapshot_filename);
+      return( -1);
+      }
+
+   changed = (obj_t **)malloc( obj_aft.n_objs * sizeof( obj_t *));
+   assert( changed);
+   for( i = 0; i < obj_aft.n_objs; i++)
+      {
+      obj_t *obj = obj_aft.objs + i;
+      obj_t *prev = find_object( &obj_bef, obj->packed);
+
+      if( !prev || prev->hash != obj->hash)
+         {
+         obj->is_changed = 1;
+         changed[n_changed++] = obj;
+         if( prev)
+            prev->is_changed = 1;
+         }
+      }
+   for( i = 0; i < obj_bef.n_objs; i++)       /* objects that vanished */
+      if( !find_object( &obj_aft, obj_bef.objs[i].packed))
+         obj_bef.objs[i].is_changed = 1;
+            /* list changes in order of packed ID,  not file order : */
+   qsort( changed, n_changed, sizeof( obj_t *), obj_ptr_compare);
+   for( i = 0; i < n_changed; i++)
+      if( find_object( &obj_bef, changed[i]->packed))
+         printf( "%.12s changed\n", changed[i]->packed);
+      else
+         printf( "%.12s wasn't in %s\n", changed[i]->packed, argv[1]);
+   free( changed);
+   printf( "%u objects have changed\n", n_changed);
    is_nsd_obs = strstr( argv[1], "nsd.obs");
-   if( argc >= 4 && argv[3][0] != '-')
+   if( output_filename && show_delta)
+      {
+      FILE *ofile = fopen( output_filename, "wb");
+
+      assert( ofile);
+      write_delta( ofile, &before, &obj_bef, &after, &obj_aft, is_nsd_obs);
+      fclose( ofile);
+      }
+   else if( output_filename)
       {
-      FILE *ofile = fopen( argv[3], "wb");
-      char buff[90], prev_packed[12];
+      FILE *ofile = fopen( output_filename, "wb");
+      size_t loc = 0;
+      const char *prev_packed = NULL;
       int changed_or_new = 0;
 
       assert( ofile);
-      fseek( after, 0L, SEEK_SET);
-      memset( prev_packed, 0, sizeof( prev_packed));
-      while( fgets( buff, sizeof( buff), after))
+      while( loc < after.len)
          {
-         if( memcmp( prev_packed, buff, 12))       /* new packed desig */
-            {
-            memcpy( prev_packed, buff, 12);
-            changed_or_new =
-                   (NULL != bsearch( buff, obj_aft, n_aft, sizeof( obj_t), obj_compare));
+         const size_t next = next_line( after.data, after.len, loc);
+         const char *line = after.data + loc;
+
+         if( next - loc < 12)
+            changed_or_new = 0;
+         else if( !prev_packed || memcmp( prev_packed, line, 12))
+            {                               /* new packed desig */
+            const obj_t *obj = find_object( &obj_aft, line);
+
+            prev_packed = line;
+            changed_or_new = (obj && obj->is_changed);
             }
          if( changed_or_new)
             {
-            if( is_nsd_obs)      /* mark obs as 'do not distribute' */
-               buff[72] = '!';
-            fputs( buff, ofile);
+            if( is_nsd_obs && next - loc > 72)
+               {              /* mark obs as 'do not distribute' */
+               fwrite( line, 72, 1, ofile);
+               fputc( '!', ofile);
+               fwrite( line + 73, next - loc - 73, 1, ofile);
+               }
+            else
+               fwrite( line, next - loc, 1, ofile);
             }
+         loc = next;
          }
       fclose( ofile);
       }
-   fclose( after);
-   free( obj_aft);
+   unmap_file( &before);
+   unmap_file( &after);
+   free_table( &obj_bef);
+   free_table( &obj_aft);
    return( 0);
 }
@@ -18,6 +18,12 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <assert.h>
+#include "mapfile.h"
+#include "par_sort.h"
+#include "mpc_key.h"
 
 /* This reads in UnnObs.txt (MPC file of astrometry for unnumbered objects)
 and the list of identifications and list of double designations,  available at
@@ -34,12 +40,15 @@ J81E35NK14F21N
 
    tells us that J81E35N = 1981 EN35 and K14F21N = 2014 FN21 are the same
 object.  'fix_obs' will find all instances of K14F21N and mark them to
-be changed to J81E35N.  After we've gone through all lines in 'ids.txt'
-and 'dbl.txt', we go back and actually revise such instances to J81E35N.
-(We can't revise them as we go.  The code that finds all instances of
-K14F21N uses a binary search -- look at 'fix_desig' below;  if we altered
-the input data,  the data wouldn't be sorted anymore and the next binary
-search might fail.  So the actual replacement has to be a final step.)
+be changed to J81E35N.  To do that,  we read all the (old, new) pairs
+from 'ids.txt' and 'numids.txt' and sort them by old designation.  Since
+UnnObs.txt is also sorted by designation,  one pass through both lists
+finds every match -- see 'find_identifications()' below.  Chains of
+identifications (A=B on one line,  B=C on another) are followed through,
+so C's observations end up as A.  After that,
+we go back and actually revise such instances to J81E35N.  (We can't
+revise them as we go;  if we altered the input data,  the data wouldn't
+be sorted anymore.  So the actual replacement has to be a final step.)
 
    The result is sorted out by designation and date (i.e.,  same sort
 order as the original 'UnnObs.txt') and written out to UnnObs2.txt.
@@ -48,110 +57,462 @@ order as the original 'UnnObs.txt') and written out to UnnObs2.txt.
 will be "correctly" identified instead of being left with their old
 designations.
 
-   Compile the program with either g++ or clang :
+   Compile the program with either gcc or clang :
 
-g++ -Wall -O3 -pedantic -o fix_obs fix_obs.cpp
-clang -Wall -O3 -pedantic -o fix_obs fix_obs.cpp
+gcc -Wall -O3 -pedantic -o fix_obs fix_obs.c mapfile.c par_sort.c \
+                              mpc_key.c -lpthread
+clang -Wall -O3 -pedantic -o fix_obs fix_obs.c mapfile.c par_sort.c \
+                              mpc_key.c -lpthread
 
    You can run with the command line argument '-x' to have the old
 designations saved in columns 57 to 63 (they're usually blank and
-ignored anyway).  */
+ignored anyway).
+
+   With '-k',  UnnObs.txt is memory-mapped (copy-on-write) rather than
+read into a gigabyte-sized buffer,  and instead of qsort()ing the 81-byte
+records themselves,  we build an array of (sort key, record number) pairs
+and sort that.  Each key is computed once,  so a comparison is a single
+memcmp() instead of the walk through mpc_line_compare(),  and a swap
+moves 40 bytes instead of 81.  The sorted records are then gathered from the
+mapping as they're written out.  Output is identical to the default mode,
+down to the order of records that compare as equal (see key_compare()):
+unchanged records come before re-designated ones,  and otherwise,  the
+input order is kept.
+
+   '-j N' sorts using N threads (see 'par_sort.c');  '-j' alone uses all
+available processors.  Again,  output is unchanged.  The time taken by
+each phase is shown,  to make it easy to see how well this scales.
+
+   Only the records that actually got new designations are sorted;  they
+are then merged with the rest,  which are already in order (see
+split_out_changed() below).  If the input turns out not to have been
+sorted,  or you use '-f',  everything is sorted.
+
+   '-i NumObs.txt' will process NumObs.txt instead of UnnObs.txt;  output
+then goes to NumObs2.txt,  unless you specify '-o (filename)'.  Since
+that file (and others) may not fit into memory,  '-m 512M' (or '-m 2G',
+etc.) tells fix_obs to sort out-of-core,  using no more than that much
+memory for the astrometry;  see external_sort() below.   */
+
+/* The sort order is defined in 'mpc_key.c'.  With '-k',  we sort an
+array of these,  each holding a record's key and its record number.   */
+
+typedef struct
+{
+   char key[MPC_KEY_LEN];
+   uint32_t idx;
+} obs_key_t;
+
+/* Only the keys are compared.  parallel_sort() is stable,  so keys that
+tie stay in the order in which they were built (see main()),  which is
+the order in which the default mode has the records when it sorts them. */
 
-/* Some notes on the sort order for the MPC files:
+static int key_compare( const void *aptr, const void *bptr)
+{
+   const obs_key_t *a = (const obs_key_t *)aptr;
+   const obs_key_t *b = (const obs_key_t *)bptr;
 
-   -- Bill Zielenbach pointed out that the comparison goes beyond just the
-designation and the date/time.  If those are identical,  you need to look
-at the observation type (in column 15);  otherwise,  two-line observations
-(radar,  roving observer,  satellite) won't get sorted.  Also,  it does
-sometimes happen that the same object is observed simultaneously at two
-stations,  so the MPC code has to be compared.
+   return( memcmp( a->key, b->key, MPC_KEY_LEN));
+}
 
-   -- 2001 QW322 is an unusual case.  It's the only binary TNO in the file,
-and has an a and a b component,  with the letter stuck between the year and
-month.  That gets you input such as
+#ifdef __GNUC__
+void err_exit( const char *message, const int error_code)  __attribute__ ((noreturn));
+#endif
 
-     K01QW2W 5C2003a10 28.01437 20 40 46.15 -18 41 48.2                 k3026309
-     K01QW2W 5C2003b10 28.01437 20 40 45.98 -18 41 46.5                 k3026309
+void err_exit( const char *message, const int error_code)
+{
+   if( message)
+      printf( "%s", message);
+   printf( "Hit Enter:\n");
+   getchar( );
+   exit( error_code);
+}
 
-   -- This works with UnnObs.txt (I wrote a bit of test code that verified
-that compared records looking for incorrect ordering).  It fails with CmtObs.txt
-and SatObs.txt.  Those involve some additional rules.  I'll probably fix this --
-you'll see that I did some work to deal with comet ordering -- but my priority
-was getting it to work for UnnObs.txt.                   */
+#define is_power_of_two( X)   (!((X) & ((X) - 1)))
 
-static int mpc_compare( const void *aptr, const void *bptr)
+typedef struct
 {
-   const char *a = (const char *)aptr;
-   const char *b = (const char *)bptr;
-   int rval = 0;
+   char old_desig[7], new_desig[7];
+} id_pair_t;
 
-   if( a[4] == 'P' && b[4] == 'P'     /* compare permanent period comet desig */
-               && memcmp( a, "    ", 4) && memcmp( b, "    ", 4))
-      rval = memcmp( a, b, 4);
+static id_pair_t *add_id_pair( id_pair_t *pairs, size_t *n_pairs,
+               const char *new_desig, const char *old_desig)
+{
+   const size_t n = ++*n_pairs;
+
+   if( is_power_of_two( n))
+      {
+      pairs = (id_pair_t *)realloc( pairs, 2 * n * sizeof( id_pair_t));
+      if( !pairs)
+         {
+         fprintf( stderr, "Couldn't allocate memory for identifications\n");
+         exit( -3);
+         }
+      }
+   memcpy( pairs[n - 1].old_desig, old_desig, 7);
+   memcpy( pairs[n - 1].new_desig, new_desig, 7);
+   return( pairs);
+}
+
+/* Each record gets an 'xdesig' slot of XDESIG_LEN bytes,  giving new
+contents for its columns 1-12 :  a packed number in bytes 0-4 and/or a
+provisional designation in bytes 5-11.  Either part is left as zeroes if
+it isn't to be changed. */
+
+#define XDESIG_LEN 12
+
+static void set_xdesig( char *xdesig, const char *new_desig)
+{
+   if( new_desig[5] == ' ')         /* numbered */
+      memcpy( xdesig, new_desig, 5);
    else
-      rval = memcmp( a, b, 12);        /* compare entire ID */
-   if( !rval)              /* same ID,  so compare by year */
-      rval = memcmp( a + 15, b + 15, 4);
-   if( !rval)              /* same year;  compare month/day */
-      rval = memcmp( a + 20, b + 20, 12);
-   if( !rval)              /* still the same;  compare by note 2 */
-      rval = (int)a[14] - (int)b[14];
-   if( !rval)           /* Still the same:  compare by comet component */
-      rval = (int)a[11] - (int)b[11];
-   if( !rval)
-      rval = (int)b[10] - (int)a[10];
-   if( !rval)              /* now compare by MPC code */
-      rval = memcmp( a + 77, b + 77, 3);
-   if( !rval)           /* Still the same:  compare by asteroid component */
-      rval = (int)a[19] - (int)b[19];
-   return( rval);
+      memcpy( xdesig + 5, new_desig, 7);
+}
+
+static int is_changed( const char *xdesig)
+{
+   return( xdesig[0] || xdesig[5]);
 }
 
-static void fix_desig( const char *obs, const size_t n_lines,
-               const char *new_desig, const char *old_desig,
-               char *xdesigs)
+static int desig_compare( const void *a, const void *b)
 {
-   size_t loc = 0, loc1, step;
-   int compare, n_found = 0;
-   const char *tptr;
+   return( memcmp( a, b, 7));
+}
+
+static uint32_t desig_index( const char *desigs, const size_t n_desigs,
+                             const char *desig)
+{
+   const char *tptr = (const char *)bsearch( desig, desigs, n_desigs, 7,
+                                             desig_compare);
+
+   assert( tptr);
+   return( (uint32_t)( ( tptr - desigs) / 7));
+}
 
-/* printf( "Replacing %.7s with %.7s\n", old_desig, new_desig);   */
-   for( step = (size_t)0x80000000; step; step >>= 1)
-      if( (loc1 = loc + step) < n_lines)
-         if( memcmp( obs + loc1 * 81 + 5, old_desig, 7) < 0)
-            loc = loc1;
-   tptr = obs + loc * 81 + 5;
-   xdesigs += loc * 7;
-   while( loc < n_lines && (compare = memcmp( tptr, old_desig, 7)) <= 0)
+static uint32_t find_root( uint32_t *parent, uint32_t idx)
+{
+   while( parent[idx] != idx)
       {
-      if( !compare)
+      parent[idx] = parent[parent[idx]];        /* path halving */
+      idx = parent[idx];
+      }
+   return( idx);
+}
+
+/* Identifications can chain.  If one line of ids.txt says A=B and a
+later one says B=C,  applying each line on its own would leave C's
+observations under B,  and you'd have to run fix_obs again to get them
+to A.  So we treat each (old, new) pair as a union of two sets in a
+union-find structure over every designation mentioned,  and each
+observation is then re-designated to the root of its set.
+
+   Normally,  the root of the new designation becomes the root of the
+merged set,  so (as with applying pairs in order) later identifications
+take precedence.  Numbered designations (from numids.txt) are handled
+separately,  since they go in columns 1-5 and leave the provisional
+designation alone.  A numbered designation never becomes the root of a
+set containing provisional ones;  instead,  each root records the number
+(if any) for its set,  and records get both the root's provisional
+designation and that number.  So with ids A=B and numids N=A,  B's
+records become 'N A'.  */
+
+#define IS_NUMBERED( desig)   ((desig)[6] == ' ')
+
+typedef struct
+{
+   char *desigs;              /* sorted,  no duplicates,  7 bytes each */
+   uint32_t *parent;          /* union-find links */
+   uint32_t *number;          /* for roots:  1 + index of the set's number */
+   char *found;               /* non-zero if desig was seen in the input */
+   size_t n_desigs;
+} id_table_t;
+
+static void build_id_table( id_table_t *table, const id_pair_t *pairs,
+                            const size_t n_pairs)
+{
+   char *desigs = (char *)malloc( n_pairs * 14 + 1);
+   uint32_t *parent, *number;
+   size_t i, n_desigs, n_roots = 0;
+
+   if( !desigs)
+      err_exit( "Couldn't allocate memory for identifications\n", -3);
+   for( i = 0; i < n_pairs; i++)
+      {
+      memcpy( desigs + i * 14, pairs[i].old_desig, 7);
+      memcpy( desigs + i * 14 + 7, pairs[i].new_desig, 7);
+      }
+   qsort( desigs, n_pairs * 2, 7, desig_compare);
+   for( i = n_desigs = 0; i < n_pairs * 2; i++)
+      if( !n_desigs || memcmp( desigs + (n_desigs - 1) * 7, desigs + i * 7, 7))
+         memmove( desigs + 7 * n_desigs++, desigs + i * 7, 7);
+   parent = (uint32_t *)malloc( (n_desigs + 1) * sizeof( uint32_t));
+   number = (uint32_t *)malloc( (n_desigs + 1) * sizeof( uint32_t));
+   table->found = (char *)calloc( n_desigs + 1, 1);
+   if( !parent || !number || !table->found)
+      err_exit( "Couldn't allocate memory for identifications\n", -3);
+   for( i = 0; i < n_desigs; i++)
+      {
+      parent[i] = (uint32_t)i;
+      number[i] = (IS_NUMBERED( desigs + i * 7) ? (uint32_t)i + 1 : 0);
+      }
+   for( i = 0; i < n_pairs; i++)
+      {
+      const uint32_t old_root = find_root( parent,
+                     desig_index( desigs, n_desigs, pairs[i].old_desig));
+      const uint32_t new_root = find_root( parent,
+                     desig_index( desigs, n_desigs, pairs[i].new_desig));
+
+      if( old_root != new_root)
          {
-         if( new_desig[5] == ' ')         /* numbered */
-            memcpy( xdesigs - 5, new_desig, 5);
+         const uint32_t merged_number = (number[new_root] ?
+                                 number[new_root] : number[old_root]);
+
+         if( IS_NUMBERED( desigs + new_root * 7)
+                     && !IS_NUMBERED( desigs + old_root * 7))
+            {
+            parent[new_root] = old_root;
+            number[old_root] = merged_number;
+            }
          else
-            memcpy( xdesigs, new_desig, 7);
-         n_found++;
+            {
+            parent[old_root] = new_root;
+            number[new_root] = merged_number;
+            }
          }
-      tptr += 81;
-      xdesigs += 7;
-      loc++;
       }
-   if( !n_found && new_desig[6] != ' ')
-      fprintf( stderr, "No fix for %.7s = %.7s\n", old_desig, new_desig);
-/* printf( "Replaced %d,  starting at %ld\n", (int)( loc - loc1), (long)loc1); */
+   for( i = 0; i < n_desigs; i++)
+      if( find_root( parent, (uint32_t)i) == i)
+         n_roots++;
+   printf( "%ld designations resolve to %ld objects\n", (long)n_desigs,
+                                                       (long)n_roots);
+   table->desigs = desigs;
+   table->parent = parent;
+   table->number = number;
+   table->n_desigs = n_desigs;
 }
 
-#ifdef __GNUC__
-void err_exit( const char *message, const int error_code)  __attribute__ ((noreturn));
+static void mark_identification( id_table_t *table, const uint32_t idx,
+                                 char *xdesig)
+{
+   const uint32_t root = find_root( table->parent, idx);
+
+   table->found[idx] = 1;
+   if( root != idx && !IS_NUMBERED( table->desigs + root * 7))
+      set_xdesig( xdesig, table->desigs + root * 7);
+   if( table->number[root])
+      set_xdesig( xdesig, table->desigs + (table->number[root] - 1) * 7);
+}
+
+/* Finds records to be re-designated in input that isn't necessarily
+sorted by provisional designation (pieces of a file being sorted
+out-of-core,  or files in other orders,  such as NumObs.txt).  We look up
+each designation in the table,  but only when it changes from one record
+to the next.  */
+
+static void lookup_identifications( const char *obs, const size_t n_lines,
+                                    id_table_t *table, char *xdesigs)
+{
+   size_t i;
+   const char *prev = NULL, *tptr = NULL;
+
+   for( i = 0; i < n_lines; i++)
+      {
+      const char *desig = obs + i * 81 + 5;
+
+      if( !prev || memcmp( prev, desig, 7))
+         {
+         tptr = (const char *)bsearch( desig, table->desigs, table->n_desigs,
+                                       7, desig_compare);
+         prev = desig;
+         }
+      if( tptr)
+         mark_identification( table, (uint32_t)( ( tptr - table->desigs) / 7),
+                              xdesigs + i * XDESIG_LEN);
+      }
+}
+
+/* If the observations are in order by provisional designation (columns
+6-12),  as UnnObs.txt is,  then since the table is also in order,  a single
+merge pass through both finds every record to be re-designated.  Other
+files (NumObs.txt,  for one) are sorted by number first.  If we find a
+record out of order,  we look up the rest individually (see above).  */
+
+static void find_identifications( const char *obs, const size_t n_lines,
+                                  id_table_t *table, char *xdesigs)
+{
+   size_t i, j;
+
+   for( i = j = 0; i < n_lines; i++)
+      {
+      const char *desig = obs + i * 81 + 5;
+      int compare = -1;
+
+      if( i && memcmp( desig - 81, desig, 7) > 0)
+         {
+         lookup_identifications( obs + i * 81, n_lines - i, table,
+                                 xdesigs + i * XDESIG_LEN);
+         return;
+         }
+      while( j < table->n_desigs
+             && (compare = memcmp( table->desigs + j * 7, desig, 7)) < 0)
+         j++;
+      if( !compare)
+         mark_identification( table, (uint32_t)j, xdesigs + i * XDESIG_LEN);
+      }
+}
+
+/* Complain about any (non-numbered) identifications for which no records
+were found,  in the order in which they were read. */
+
+static void report_unfound( const id_table_t *table, const id_pair_t *pairs,
+                            const size_t n_pairs)
+{
+   size_t i;
+
+   for( i = 0; i < n_pairs; i++)
+      if( !table->found[desig_index( table->desigs, table->n_desigs,
+                                     pairs[i].old_desig)]
+                     && pairs[i].new_desig[6] != ' ')
+         fprintf( stderr, "No fix for %.7s = %.7s\n", pairs[i].old_desig,
+                                                      pairs[i].new_desig);
+}
+
+static void free_id_table( id_table_t *table)
+{
+   free( table->desigs);
+   free( table->parent);
+   free( table->number);
+   free( table->found);
+}
+
+static size_t apply_xdesigs( char *obs, const size_t n_lines,
+                       const char *xdesigs, const int add_old_desig)
+{
+   size_t i, n_changed = 0;
+
+   for( i = 0; i < n_lines; i++, xdesigs += XDESIG_LEN)
+      if( is_changed( xdesigs))
+         {
+         char *tptr = obs + i * 81;
+
+         if( xdesigs[5])
+            {
+            if( add_old_desig && tptr[14] == 'C')
+               memcpy( tptr + 56, tptr + 5, 7);
+            memcpy( tptr + 5, xdesigs + 5, 7);
+            }
+         if( xdesigs[0])
+            memcpy( tptr, xdesigs, 5);
+         n_changed++;
+         }
+   return( n_changed);
+}
+
+/* Wall-clock seconds since the previous call.  (On Windows,  clock()
+returns wall time,  not CPU time,  so it'll do.)  */
+
+static double elapsed_seconds( void)
+{
+   static double prev;
+   double t, rval;
+#ifdef _WIN32
+   t = (double)clock( ) / (double)CLOCKS_PER_SEC;
+#else
+   struct timespec ts;
+
+   clock_gettime( CLOCK_MONOTONIC, &ts);
+   t = (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
 #endif
+   rval = (prev ? t - prev : 0.);
+   prev = t;
+   return( rval);
+}
 
-void err_exit( const char *message, const int error_code)
+/* Usually,  only a small fraction of records get new designations.  The
+rest are still in sorted order (assuming the input was sorted),  so rather
+than re-sorting everything,  we pull out just the changed records,  sort
+those,  and merge them with the unchanged ones as we write the output.
+
+split_out_changed() copies the changed records to 'moved' and packs the
+unchanged ones down to the start of 'obs',  preserving their order.  It
+returns 0 if the unchanged records turn out not to be in order,  in
+which case the caller should fall back to sorting everything.  */
+
+static int split_out_changed( char *obs, const size_t n_lines,
+                              const char *xdesigs, char *moved)
 {
-   if( message)
-      printf( "%s", message);
-   printf( "Hit Enter:\n");
-   getchar( );
-   exit( error_code);
+   size_t i, n_kept = 0;
+   int is_sorted = 1;
+
+   for( i = 0; i < n_lines; i++, xdesigs += XDESIG_LEN)
+      if( is_changed( xdesigs))
+         {
+         memcpy( moved, obs + i * 81, 81);
+         moved += 81;
+         }
+      else
+         {
+         if( n_kept && is_sorted
+                && mpc_line_compare( obs + (n_kept - 1) * 81, obs + i * 81) > 0)
+            is_sorted = 0;
+         if( n_kept != i)
+            memcpy( obs + n_kept * 81, obs + i * 81, 81);
+         n_kept++;
+         }
+   return( is_sorted);
+}
+
+/* Writes the merge of two sorted arrays of records.  Runs of records
+from 'a' are written with a single fwrite().  Ties go to 'a' (the records
+that weren't changed).  */
+
+static void write_merged_records( FILE *ofile, const char *a, size_t n_a,
+                                          const char *b, size_t n_b)
+{
+   while( n_a || n_b)
+      {
+      size_t run = 0;
+
+      if( !n_b)
+         run = n_a;
+      else while( run < n_a && mpc_line_compare( a + run * 81, b) <= 0)
+         run++;
+      fwrite( a, 81, run, ofile);
+      a += run * 81;
+      n_a -= run;
+      if( n_b)
+         {
+         fwrite( b, 81, 1, ofile);
+         b += 81;
+         n_b--;
+         }
+      }
+}
+
+/* Same thing for '-k' mode,  except that we're merging keys and
+gathering the corresponding records from the mapped file.  Again,  ties
+go to 'a',  whatever the record numbers.  */
+
+static void write_merged_keys( FILE *ofile, const char *obs,
+                               const obs_key_t *a, size_t n_a,
+                               const obs_key_t *b, size_t n_b)
+{
+   while( n_a || n_b)
+      {
+      const obs_key_t *kptr;
+
+      if( !n_b || (n_a && key_compare( a, b) <= 0))
+         {
+         kptr = a++;
+         n_a--;
+         }
+      else
+         {
+         kptr = b++;
+         n_b--;
+         }
+      fwrite( obs + (size_t)kptr->idx * 81, 81, 1, ofile);
+      }
 }
 
 static FILE *err_fopen( const char *filename, const char *permits)
@@ -168,48 +529,291 @@ static FILE *err_fopen( const char *filename, const char *permits)
    return( rval);
 }
 
+/* With '-m',  fix_obs works out-of-core,  so that files too large for
+memory (NumObs.txt,  say) can be handled.  The input is read in chunks
+that fit within the given memory budget.  Each chunk is re-designated
+(looking up designations in the ID table,  since we can't assume the
+chunk lines up with anything),  sorted,  and written to a temporary
+file as a sorted 'run'.  The runs are then merged,  using a heap to
+find the run with the lowest current record.  Ties go to the earlier
+run,  so the result is the same as a (stable) sort of the whole file.  */
+
+typedef struct
+{
+   FILE *fp;
+   char *buff;
+   size_t n_recs, loc;        /* records in buffer,  current record */
+} run_t;
+
+static const char *current_record( const run_t *run)
+{
+   return( run->loc < run->n_recs ? run->buff + run->loc * 81 : NULL);
+}
+
+static void advance_run( run_t *run, const size_t buff_recs)
+{
+   run->loc++;
+   if( run->loc >= run->n_recs)
+      {
+      run->n_recs = fread( run->buff, 81, buff_recs, run->fp);
+      run->loc = 0;
+      }
+}
+
+static int run_compare( const run_t *runs, const int a, const int b)
+{
+   const int rval = mpc_line_compare( current_record( runs + a),
+                                 current_record( runs + b));
+
+   return( rval ? rval : a - b);
+}
+
+static void sift_down( int *heap, const int n, int i, const run_t *runs)
+{
+   for( ;;)
+      {
+      int smallest = i;
+      const int left = 2 * i + 1, right = left + 1;
+
+      if( left < n && run_compare( runs, heap[left], heap[smallest]) < 0)
+         smallest = left;
+      if( right < n && run_compare( runs, heap[right], heap[smallest]) < 0)
+         smallest = right;
+      if( smallest == i)
+         return;
+      else
+         {
+         const int temp = heap[i];
+
+         heap[i] = heap[smallest];
+         heap[smallest] = temp;
+         i = smallest;
+         }
+      }
+}
+
+static size_t merge_runs( FILE *ofile, run_t *runs, const int n_runs,
+                          const size_t buff_recs)
+{
+   int *heap = (int *)malloc( n_runs * sizeof( int)), n = 0, i;
+   size_t n_written = 0;
+
+   if( !heap)
+      err_exit( "Couldn't allocate memory for merging\n", -3);
+   for( i = 0; i < n_runs; i++)
+      {
+      runs[i].buff = (char *)malloc( buff_recs * 81);
+      if( !runs[i].buff)
+         err_exit( "Couldn't allocate memory for merging\n", -3);
+      rewind( runs[i].fp);
+      runs[i].n_recs = fread( runs[i].buff, 81, buff_recs, runs[i].fp);
+      runs[i].loc = 0;
+      if( runs[i].n_recs)
+         heap[n++] = i;
+      }
+   for( i = n / 2 - 1; i >= 0; i--)
+      sift_down( heap, n, i, runs);
+   while( n)
+      {
+      run_t *run = runs + heap[0];
+
+      fwrite( current_record( run), 81, 1, ofile);
+      n_written++;
+      advance_run( run, buff_recs);
+      if( !current_record( run))
+         heap[0] = heap[--n];
+      sift_down( heap, n, 0, runs);
+      }
+   for( i = 0; i < n_runs; i++)
+      {
+      free( runs[i].buff);
+      fclose( runs[i].fp);       /* tmpfile()s go away when closed */
+      }
+   free( heap);
+   return( n_written);
+}
+
+static void check_file_length( const char *filename, const size_t len)
+{
+   if( len % 81)
+      {
+      char buff[200];
+
+      snprintf( buff, sizeof( buff), "%.100s ought to be a multiple of 81 "
+                     "bytes long.  It isn't.\n", filename);
+      err_exit( buff, -2);
+      }
+}
+
+static void external_sort( const char *ifilename, const char *ofilename,
+            id_table_t *table, const size_t mem_budget, const int n_threads,
+            const int add_old_desig)
+{
+            /* each record,  plus its slot in the sort's scratch buffer */
+            /* (needed for any number of threads),  plus its xdesig */
+   const size_t bytes_per_rec = 2 * 81 + XDESIG_LEN;
+   size_t chunk_recs = mem_budget / bytes_per_rec, n_read, n_changed = 0;
+   FILE *ifile = err_fopen( ifilename, "rb");
+   FILE *ofile = NULL;
+   char *chunk, *scratch, *xdesigs;
+   run_t *runs = NULL;
+   int n_runs = 0;
+
+   if( chunk_recs < 1000)
+      chunk_recs = 1000;
+   chunk = (char *)malloc( chunk_recs * 81);
+   scratch = (char *)malloc( chunk_recs * 81 + 81);
+   xdesigs = (char *)malloc( chunk_recs * XDESIG_LEN);
+   if( !chunk || !scratch || !xdesigs)
+      err_exit( "Couldn't allocate memory for sorting\n", -3);
+   fseek( ifile, 0L, SEEK_END);
+   check_file_length( ifilename, (size_t)ftell( ifile));
+   fseek( ifile, 0L, SEEK_SET);
+   while( (n_read = fread( chunk, 81, chunk_recs, ifile)) > 0)
+      {
+      memset( xdesigs, 0, chunk_recs * XDESIG_LEN);
+      lookup_identifications( chunk, n_read, table, xdesigs);
+      n_changed += apply_xdesigs( chunk, n_read, xdesigs, add_old_desig);
+      parallel_sort_with_buffer( chunk, scratch, n_read, 81,
+                                 mpc_line_compare, n_threads);
+      if( !n_runs && n_read < chunk_recs)     /* it all fit in one chunk */
+         {
+         ofile = err_fopen( ofilename, "wb");
+         fwrite( chunk, 81, n_read, ofile);
+         break;
+         }
+      runs = (run_t *)realloc( runs, (n_runs + 1) * sizeof( run_t));
+      if( !runs || !(runs[n_runs].fp = tmpfile( )))
+         err_exit( "Couldn't create temporary file\n", -1);
+      if( fwrite( chunk, 81, n_read, runs[n_runs].fp) != n_read)
+         err_exit( "Couldn't write temporary file\n", -4);
+      n_runs++;
+      printf( "Run %d : %ld records sorted (%.3f s)\n", n_runs, (long)n_read,
+                                  elapsed_seconds( ));
+      }
+   fclose( ifile);
+   free( chunk);
+   free( scratch);
+   free( xdesigs);
+   printf( "%ld records have new designations\n", (long)n_changed);
+   if( !ofile)
+      {
+      const size_t buff_recs = mem_budget / (81 * (size_t)( n_runs + 1)) + 1;
+      size_t n_written;
+
+      ofile = err_fopen( ofilename, "wb");
+      printf( "Merging %d runs to %s\n", n_runs, ofilename);
+      n_written = merge_runs( ofile, runs, n_runs, buff_recs);
+      printf( "%ld records merged (%.3f s)\n", (long)n_written,
+                                  elapsed_seconds( ));
+      }
+   fclose( ofile);
+   free( runs);
+}
+
+/* Memory budgets are given as,  e.g.,  '-m 512M' or '-m2G'.  Anything
+else (including a missing or zero value) is an error;  we don't want to
+quietly fall back to sorting in memory.  */
+
+static size_t parse_memory_size( const char *str)
+{
+   char *endptr;
+   double rval = strtod( str, &endptr);
+
+   if( *endptr == 'k' || *endptr == 'K')
+      rval *= 1024.;
+   else if( *endptr == 'm' || *endptr == 'M')
+      rval *= 1024. * 1024.;
+   else if( *endptr == 'g' || *endptr == 'G')
+      rval *= 1024. * 1024. * 1024.;
+   if( endptr == str || rval < 1. || (*endptr
+               && (endptr[1] || !strchr( "kKmMgG", *endptr))))
+      {
+      char buff[100];
+
+      snprintf( buff, sizeof( buff), "Invalid memory size '%.30s' for '-m'\n"
+                     "Use,  e.g.,  '-m 512M' or '-m 2G'\n", str);
+      err_exit( buff, -1);
+      }
+   return( (size_t)rval);
+}
+
+/* Options can be given as,  e.g.,  '-m512M' or '-m 512M'. */
+
+static const char *option_value( const int argc, const char **argv,
+                                 const size_t i)
+{
+   if( argv[i][2])
+      return( argv[i] + 2);
+   else if( i + 1 < (size_t)argc)
+      return( argv[i + 1]);
+   return( "");
+}
+
 int main( const int argc, const char **argv)
 {
-   FILE *ifile = err_fopen( "UnnObs.txt", "rb");
+   FILE *ifile;
    FILE *ofile;
    char *obs, *xdesigs;
-   char iline[80];
-   size_t i, len, n_lines;
-   int add_old_desig = 0;
+   char iline[80], default_ofilename[200];
+   const char *ifilename = "UnnObs.txt", *ofilename = NULL;
+   size_t i, len, n_lines, n_changed, n_kept, mem_budget = 0;
+   int add_old_desig = 0, use_keys = 0, n_threads = 1, full_sort = 0;
+   mapped_file_t mapped;
+   id_pair_t *pairs = NULL;
+   size_t n_pairs = 0;
+   id_table_t table;
 
    printf( "Starting fix_obs.  Total runtime should be a few seconds.\n");
+   elapsed_seconds( );
    for( i = 1; i < (size_t)argc; i++)
       if( argv[i][0] == '-')
          switch( argv[i][1])
             {
+            case 'f':
+               full_sort = 1;
+               break;
+            case 'i':
+               ifilename = option_value( argc, argv, i);
+               break;
+            case 'j':
+               if( argv[i][2])
+                  n_threads = atoi( argv[i] + 2);
+               else if( i + 1 < (size_t)argc && atoi( argv[i + 1]) > 0)
+                  n_threads = atoi( argv[i + 1]);
+               else
+                  n_threads = n_cpus_available( );
+               break;
+            case 'k':
+               use_keys = 1;
+               break;
+            case 'm':
+               mem_budget = parse_memory_size( option_value( argc, argv, i));
+               break;
+            case 'o':
+               ofilename = option_value( argc, argv, i);
+               break;
             case 'x':
                add_old_desig = 1;
                break;
             }
-
-   fseek( ifile, 0L, SEEK_END);
-   len = (size_t)ftell( ifile);
-   printf( "%ld lines of astrometry\n", (long)len / 81L);
-   if( len % 81L)
-      err_exit( "UnnObs.txt ought to be a multiple of 81 bytes long.  It isn't.\n"
-                "It also should have about 10 million lines of astrometry.\n", -2);
-   n_lines = len / 81;
-   obs = (char *)malloc( len);
-   xdesigs = (char *)calloc( n_lines, 7);
-   if( !obs || !xdesigs)
-      err_exit( "Couldn't allocate memory (should need about a gigabyte).\n", -3);
-   printf( "Memory allocated\n");
-   fseek( ifile, 0L, SEEK_SET);
-   if( fread( obs, 1, len, ifile) != len)
-      err_exit( "Couldn't read all data from UnnObs.txt\n", -4);
-   printf( "Astrometry read\n");
-   fclose( ifile);
+   if( !ofilename)         /* UnnObs.txt -> UnnObs2.txt,  etc. */
+      {
+      const char *slash = strrchr( ifilename, '/');
+      const char *ext = strrchr( slash ? slash : ifilename, '.');
+      const int len_without_ext = (int)( ext ? (size_t)( ext - ifilename)
+                                             : strlen( ifilename));
+
+      snprintf( default_ofilename, sizeof( default_ofilename), "%.*s2%s",
+                        len_without_ext, ifilename, (ext ? ext : ""));
+      ofilename = default_ofilename;
+      }
 
    ifile = err_fopen( "ids.txt", "rb");
    printf( "Adding xdesigs from ids.txt\n");
    while( fgets( iline, sizeof( iline), ifile))
       for( i = 7; iline[i] >= ' '; i += 7)
-         fix_desig( obs, n_lines, iline, iline + i, xdesigs);
+         pairs = add_id_pair( pairs, &n_pairs, iline, iline + i);
    fclose( ifile);
 
    ifile = err_fopen( "numids.txt", "rb");
@@ -224,25 +828,155 @@ int main( const int argc, const char **argv)
          numbered_desig[6] = ' ';
          numbered_desig[7] = '\0';
          for( i = 6; i < strlen( iline) && iline[i] >= ' '; i += 7)
-            fix_desig( obs, n_lines, numbered_desig, iline + i, xdesigs);
+            pairs = add_id_pair( pairs, &n_pairs, numbered_desig, iline + i);
          }
       fclose( ifile);
       }
+   printf( "%ld identifications read (%.3f s)\n", (long)n_pairs,
+                                     elapsed_seconds( ));
+   build_id_table( &table, pairs, n_pairs);
 
-   for( i = 0; i < n_lines; i++)
-      if( xdesigs[i * 7])
+   if( mem_budget)
+      {
+      printf( "Sorting %s out-of-core,  using at most %ld MBytes\n",
+                    ifilename, (long)( mem_budget >> 20));
+      external_sort( ifilename, ofilename, &table, mem_budget, n_threads,
+                     add_old_desig);
+      report_unfound( &table, pairs, n_pairs);
+      free( pairs);
+      free_id_table( &table);
+      err_exit( "Success!\n", 0);
+      }
+
+   if( use_keys)
+      {
+      if( map_file( &mapped, ifilename, 1))
          {
-         char *tptr = obs + i * 81;
+         snprintf( iline, sizeof( iline), "Couldn't map '%.50s'\n", ifilename);
+         err_exit( iline, -1);
+         }
+      obs = mapped.data;
+      len = mapped.len;
+      printf( "%ld lines of astrometry\n", (long)len / 81L);
+      }
+   else
+      {
+      ifile = err_fopen( ifilename, "rb");
+      fseek( ifile, 0L, SEEK_END);
+      len = (size_t)ftell( ifile);
+      printf( "%ld lines of astrometry\n", (long)len / 81L);
+      obs = NULL;
+      }
+   check_file_length( ifilename, len);
+   n_lines = len / 81;
+   if( use_keys && n_lines > (size_t)UINT32_MAX)
+      err_exit( "Too many records for '-k' mode\n", -2);
+   if( !use_keys)
+      obs = (char *)malloc( len);
+   xdesigs = (char *)calloc( n_lines, XDESIG_LEN);
+   if( !obs || !xdesigs)
+      err_exit( "Couldn't allocate memory (should need about a gigabyte).\n"
+                "Try the '-m' option to sort out-of-core.\n", -3);
+   printf( "Memory allocated\n");
+   if( !use_keys)
+      {
+      fseek( ifile, 0L, SEEK_SET);
+      if( fread( obs, 1, len, ifile) != len)
+         {
+         snprintf( iline, sizeof( iline), "Couldn't read all data from %.40s\n",
+                                 ifilename);
+         err_exit( iline, -4);
+         }
+      printf( "Astrometry read (%.3f s)\n", elapsed_seconds( ));
+      fclose( ifile);
+      }
+   else
+      printf( "Astrometry mapped (%.3f s)\n", elapsed_seconds( ));
+
+   find_identifications( obs, n_lines, &table, xdesigs);
+   report_unfound( &table, pairs, n_pairs);
+   free( pairs);
+   free_id_table( &table);
+   printf( "Identifications found (%.3f s)\n", elapsed_seconds( ));
+
+   n_changed = apply_xdesigs( obs, n_lines, xdesigs, add_old_desig);
+   printf( "%ld records have new designations\n", (long)n_changed);
+   n_kept = n_lines - n_changed;
+   if( use_keys)
+      {
+      obs_key_t *keys = (obs_key_t *)malloc( n_lines * sizeof( obs_key_t));
+      size_t n_unchanged = 0, n_moved = 0;
+      int is_sorted = 1;
 
-         if( add_old_desig && tptr[14] == 'C')
-            memcpy( tptr + 56, tptr + 5, 7);
-         memcpy( tptr + 5, xdesigs + i * 7, 7);
+      if( !keys)
+         err_exit( "Couldn't allocate memory for sort keys\n", -3);
+      for( i = 0; i < n_lines; i++)
+         {
+         obs_key_t *kptr;
+
+         if( full_sort || !is_changed( xdesigs + i * XDESIG_LEN))
+            kptr = keys + n_unchanged++;
+         else
+            kptr = keys + n_kept + n_moved++;
+         mpc_sort_key( kptr->key, obs + i * 81);
+         kptr->idx = (uint32_t)i;
+         if( is_sorted && kptr != keys && kptr < keys + n_kept
+                        && key_compare( kptr - 1, kptr) > 0)
+            is_sorted = 0;       /* input wasn't sorted to begin with */
          }
-   printf( "Sorting revised astrometry\n");
-   qsort( obs, n_lines, 81, mpc_compare);
-   ofile = err_fopen( "UnnObs2.txt", "wb");
-   printf( "Writing results to UnnObs2.txt\n");
-   fwrite( obs, len, 1, ofile);
-   fclose( ofile);
+      free( xdesigs);
+      printf( "Keys built (%.3f s)\n", elapsed_seconds( ));
+      if( !is_sorted)
+         full_sort = 1;
+      if( full_sort)
+         n_kept = 0;
+      printf( "Sorting %ld keys for revised astrometry\n", (long)( n_lines - n_kept));
+      n_threads = parallel_sort( keys + n_kept, n_lines - n_kept,
+                           sizeof( obs_key_t), key_compare, n_threads);
+      printf( "Sorted with %d thread(s) (%.3f s)\n", n_threads, elapsed_seconds( ));
+      ofile = err_fopen( ofilename, "wb");
+      printf( "Writing results to %s\n", ofilename);
+      if( full_sort)
+         write_merged_keys( ofile, obs, keys, n_lines, NULL, 0);
+      else
+         write_merged_keys( ofile, obs, keys, n_kept, keys + n_kept, n_changed);
+      fclose( ofile);
+      printf( "Results written (%.3f s)\n", elapsed_seconds( ));
+      free( keys);
+      unmap_file( &mapped);
+      }
+   else
+      {
+      char *moved = NULL;
+
+      if( !full_sort)
+         {
+         moved = (char *)malloc( n_changed * 81 + 1);
+         if( !moved)
+            err_exit( "Couldn't allocate memory for revised astrometry\n", -3);
+         full_sort = !split_out_changed( obs, n_lines, xdesigs, moved);
+         if( full_sort)          /* input wasn't sorted to begin with */
+            memcpy( obs + n_kept * 81, moved, n_changed * 81);
+         }
+      free( xdesigs);
+      if( full_sort)
+         n_kept = 0;
+      printf( "Sorting %ld records of revised astrometry\n",
+                  (long)( full_sort ? n_lines : n_changed));
+      n_threads = parallel_sort( (full_sort ? obs : moved),
+               (full_sort ? n_lines : n_changed), 81, mpc_line_compare,
+               n_threads);
+      printf( "Sorted with %d thread(s) (%.3f s)\n", n_threads, elapsed_seconds( ));
+      ofile = err_fopen( ofilename, "wb");
+      printf( "Writing results to %s\n", ofilename);
+      if( full_sort)
+         write_merged_records( ofile, obs, n_lines, NULL, 0);
+      else
+         write_merged_records( ofile, obs, n_kept, moved, n_changed);
+      fclose( ofile);
+      printf( "Results written (%.3f s)\n", elapsed_seconds( ));
+      free( obs);
+      free( moved);
+      }
    err_exit( "Success!\n", 0);
 }
@@ -0,0 +1,221 @@
+/* Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+/* Test of the identification handling in 'fix_obs'.  Run as
+
+./fix_test (path to fix_obs)
+
+   (default ./fix_obs),  or with 'make test'.  This uses POSIX calls
+(mkdtemp(),  getrusage(),  etc.),  so it isn't built for Windows.
+
+   For each case below,  we make a scratch directory holding a small
+UnnObs.txt,  ids.txt,  and numids.txt,  run fix_obs on it in its
+in-memory,  '-k',  and out-of-core ('-m') modes,  and check that columns
+1-12 of each output record are as expected.  Records are identified by
+their dates,  which are all different.
+
+   The cases are chosen to exercise identification chains,  including
+chains that reach a numbered object,  and numbering the first record
+in the file (which used to write before the start of an array).
+
+   We also sort a larger file out-of-core,  and check that fix_obs stays
+(roughly) within the memory budget given with '-m'.  */
+
+static const double dates[] = { 1.1, 2.1, 3.1, 1.5, 2.5, 1.0 };
+static const char *input_desigs[] = { "K14A00A", "K14A00B", "K14A00B",
+                                      "K14A00C", "K14A00C", "K14A00D" };
+
+#define N_RECS 6
+
+typedef struct
+{
+   const char *title, *ids, *numids;
+   const char *expected[N_RECS];    /* columns 1-12,  in input order */
+} test_case_t;
+
+static const test_case_t cases[] = {
+   { "Chain of provisional designations",
+      "K14A00BK14A00C\nK14A00DK14A00B\n", "",
+      { "     K14A00A", "     K14A00D", "     K14A00D",
+        "     K14A00D", "     K14A00D", "     K14A00D" } },
+   { "Chain reaching a numbered object",
+      "K14A00BK14A00C\n", "00433 K14A00B\n",
+      { "     K14A00A", "00433K14A00B", "00433K14A00B",
+        "00433K14A00B", "00433K14A00B", "     K14A00D" } },
+   { "Numbered,  then identified with another object",
+      "K14A00CK14A00B\n", "00433 K14A00C\n",
+      { "     K14A00A", "00433K14A00C", "00433K14A00C",
+        "00433K14A00C", "00433K14A00C", "     K14A00D" } },
+   { "First record numbered",
+      "", "00433 K14A00A\n",
+      { "00433K14A00A", "     K14A00B", "     K14A00B",
+        "     K14A00C", "     K14A00C", "     K14A00D" } } };
+
+static void write_file( const char *filename, const char *text)
+{
+   FILE *ofile = fopen( filename, "wb");
+
+   if( !ofile)
+      {
+      fprintf( stderr, "Couldn't create '%s'\n", filename);
+      exit( -1);
+      }
+   fputs( text, ofile);
+   fclose( ofile);
+}
+
+static void write_input( void)
+{
+   FILE *ofile = fopen( "UnnObs.txt", "wb");
+   int i;
+
+   if( !ofile)
+      {
+      fprintf( stderr, "Couldn't create UnnObs.txt\n");
+      exit( -1);
+      }
+   for( i = 0; i < N_RECS; i++)
+      fprintf( ofile, "     %s  C2014 01 %08.5f 12 09 51.81 +35 20 39.3"
+                      "          19.6 GUNEOCPG96\n", input_desigs[i], dates[i]);
+   fclose( ofile);
+}
+
+/* Sorts BIG_RECS records (about 40 MBytes) with a budget of BIG_BUDGET
+MBytes,  and checks that the peak memory use of fix_obs (its maximum
+resident set size) is no more than a quarter over that budget.  The
+slack covers the program itself,  stdio buffers,  and so on.  Returns
+0 if all went well.  */
+
+#define BIG_RECS 500000
+#define BIG_BUDGET 16
+
+static int check_memory_use( const char *fix_obs)
+{
+   FILE *ofile = fopen( "big.txt", "wb");
+   struct rusage usage;
+   char cmd[600];
+   long max_kbytes;
+   int i, rval;
+
+   if( !ofile)
+      return( -1);
+   for( i = 0; i < BIG_RECS; i++)
+      fprintf( ofile, "     %s  C2014 01 %08.5f 12 09 51.81 +35 20 39.3"
+                      "          19.6 GUNEOCPG96\n", input_desigs[i % N_RECS],
+                      (double)( (long)i * 7919L % BIG_RECS) * 30. / BIG_RECS + 1.);
+   fclose( ofile);
+   snprintf( cmd, sizeof( cmd),
+               "%s -i big.txt -o big2.txt -m %dM < /dev/null > /dev/null",
+               fix_obs, BIG_BUDGET);
+   rval = system( cmd);
+   getrusage( RUSAGE_CHILDREN, &usage);
+#ifdef __APPLE__
+   max_kbytes = (long)usage.ru_maxrss / 1024;      /* bytes on OS/X */
+#else
+   max_kbytes = (long)usage.ru_maxrss;             /* KBytes elsewhere */
+#endif
+   printf( "Peak memory with '-m %dM' : %ld KBytes\n", BIG_BUDGET, max_kbytes);
+   if( !rval && max_kbytes > BIG_BUDGET * 1024 * 5 / 4)
+      rval = -2;
+   unlink( "big.txt");
+   unlink( "big2.txt");
+   return( rval);
+}
+
+/* Returns the number of records that are missing or wrong. */
+
+static int check_output( const test_case_t *tcase)
+{
+   FILE *ifile = fopen( "UnnObs2.txt", "rb");
+   char buff[100], date[20];
+   int i, n_found = 0, n_errors = 0;
+
+   if( !ifile)
+      return( N_RECS);
+   while( fgets( buff, sizeof( buff), ifile))
+      for( i = 0; i < N_RECS; i++)
+         {
+         snprintf( date, sizeof( date), "%08.5f", dates[i]);
+         if( !memcmp( buff + 23, date, 8))
+            {
+            n_found++;
+            if( memcmp( buff, tcase->expected[i], 12))
+               {
+               printf( "   Got '%.12s',  expected '%s'\n", buff,
+                                       tcase->expected[i]);
+               n_errors++;
+               }
+            }
+         }
+   fclose( ifile);
+   return( n_errors + (n_found == N_RECS ? 0 : N_RECS));
+}
+
+int main( const int argc, const char **argv)
+{
+   const char *modes[] = { "", "-k", "-m 1M" };
+   char fix_obs[500], dir[] = "/tmp/fix_testXXXXXX", cmd[600];
+   size_t i, j;
+   int n_failures = 0;
+
+   if( argc > 1 && argv[1][0] == '/')
+      snprintf( fix_obs, sizeof( fix_obs), "%s", argv[1]);
+   else if( getcwd( cmd, sizeof( cmd)))
+      snprintf( fix_obs, sizeof( fix_obs), "%.200s/%.200s", cmd,
+                     (argc > 1 ? argv[1] : "fix_obs"));
+   if( !mkdtemp( dir) || chdir( dir))
+      {
+      fprintf( stderr, "Couldn't make scratch directory\n");
+      return( -1);
+      }
+   write_input( );
+   for( i = 0; i < sizeof( cases) / sizeof( cases[0]); i++)
+      {
+      write_file( "ids.txt", cases[i].ids);
+      write_file( "numids.txt", cases[i].numids);
+      for( j = 0; j < sizeof( modes) / sizeof( modes[0]); j++)
+         {
+         int n_errors;
+
+         unlink( "UnnObs2.txt");
+         snprintf( cmd, sizeof( cmd), "%s %s < /dev/null > /dev/null",
+                                    fix_obs, modes[j]);
+         n_errors = (system( cmd) ? N_RECS : check_output( cases + i));
+         printf( "%s %s (%s)\n", (n_errors ? "FAIL" : "ok  "),
+                                    cases[i].title, modes[j]);
+         if( n_errors)
+            n_failures++;
+         }
+      }
+   i = (check_memory_use( fix_obs) ? 1 : 0);
+   printf( "%s Memory use within '-m' budget\n", (i ? "FAIL" : "ok  "));
+   n_failures += (int)i;
+   unlink( "UnnObs.txt");
+   unlink( "UnnObs2.txt");
+   unlink( "ids.txt");
+   unlink( "numids.txt");
+   if( chdir( "/") || rmdir( dir))
+      fprintf( stderr, "Couldn't remove %s\n", dir);
+   printf( "%d failures\n", n_failures);
+   return( n_failures);
+}
@@ -1,18 +1,30 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <ctype.h>
+#include "mapfile.h"
 
 /* Code to read in one file containing a list of object designations
 in packed form,  and then to read in another file of punched-card
 astrometry and extract just those objects.  To do that,  we read in
 all the lines in the first file (well,  just their packed designations)
-and sort them.  Then we read in the _second_ file and,  for each line,
-do a binary search to see if the temporary designation found in that
-line occurs in our sorted list from the first file.
+and put them in a hash table.  Then we go through the _second_ file
+(memory-mapped) and,  for each line,  look up the designation found in
+that line in the hash table.
 
    Usually,  the data in the second line will be sorted,  and we'll
-get plenty of lines for a given object.  So we only do the searching
-when the packed designation changes.  That speeds matters up a fair bit.
+get plenty of lines for a given object.  So we only do the lookup when
+the packed designation changes.  That speeds matters up a fair bit.
+
+   By default,  all matching lines go to stdout.  Two options allow
+splitting a file into many pieces in one pass :
+
+   -p(prefix)  Each object's lines go to their own file,  (prefix)(desig).txt.
+   -o(file)    Write a list of where each object's lines are in the
+               astrometry file.  Each line of the list gives the
+               designation,  byte offset,  and number of lines for a run
+               of consecutive lines for that object.  (If the file is
+               sorted,  that's one run per object.)
 */
 
 static void error_exit( void)
@@ -20,87 +32,270 @@ static void error_exit( void)
    fprintf( stderr,
            "'get_objs' needs two command line arguments : the name of a file\n"
            "listing packed designations of objects for which astrometry is to be\n"
-           "extracted,  and the name of a file containing the astrometry.\n");
+           "extracted,  and the name of a file containing the astrometry.\n"
+           "Options are -p(prefix),  to write each object to (prefix)(desig).txt,\n"
+           "and -o(file),  to write a list of offsets of each object's lines.\n");
    exit( -1);
 }
 
-static int compare( const void *a, const void *b)
+#define IS_POWER_OF_TWO( n)  (!((n) & ((n) - 1)))
+
+#define DESIG_LEN 13          /* 12 bytes plus a trailing nul */
+
+/* Open-addressing hash table of designations.  'slots' holds indices
+into 'desigs',  plus one (zero meaning an empty slot);  the table is
+kept at most half full.  */
+
+typedef struct
+{
+   char *desigs;
+   unsigned *slots;
+   unsigned n_desigs, table_size;
+} desig_set_t;
+
+static unsigned hash_desig( const char *desig)
+{
+   unsigned rval = 2166136261u;     /* FNV-1a */
+
+   while( *desig)
+      rval = (rval ^ (unsigned char)*desig++) * 16777619u;
+   return( rval);
+}
+
+static unsigned *find_slot( const desig_set_t *set, const char *desig)
 {
-   return( strcmp( (const char *)a, (const char *)b));
+   const unsigned mask = set->table_size - 1;
+   unsigned loc = hash_desig( desig) & mask;
+
+   while( set->slots[loc]
+           && strcmp( set->desigs + (set->slots[loc] - 1) * DESIG_LEN, desig))
+      loc = (loc + 1) & mask;
+   return( set->slots + loc);
 }
 
-#define IS_POWER_OF_TWO( n)  (!((n) & ((n) - 1)))
+/* Returns the index of the designation,  or -1 if it's not in the set */
+
+static int find_desig( const desig_set_t *set, const char *desig)
+{
+   return( set->table_size ? (int)*find_slot( set, desig) - 1 : -1);
+}
+
+static void add_desig( desig_set_t *set, const char *desig)
+{
+   unsigned *slot;
+
+   if( (set->n_desigs + 1) * 2 > set->table_size)
+      {           /* table is half full (or empty);  double it */
+      unsigned i;
+
+      set->table_size = (set->table_size ? set->table_size * 2 : 1024);
+      free( set->slots);
+      set->slots = (unsigned *)calloc( set->table_size, sizeof( unsigned));
+      for( i = 0; i < set->n_desigs; i++)
+         *find_slot( set, set->desigs + i * DESIG_LEN) = i + 1;
+      }
+   slot = find_slot( set, desig);
+   if( *slot)        /* already got it */
+      return;
+   set->n_desigs++;
+   if( IS_POWER_OF_TWO( set->n_desigs))
+      set->desigs = (char *)realloc( set->desigs,
+                                 set->n_desigs * 2 * DESIG_LEN);
+   strcpy( set->desigs + (set->n_desigs - 1) * DESIG_LEN, desig);
+   *slot = set->n_desigs;
+}
+
+/* Gets the first 'word' from the first twelve columns of a line,  as
+sscanf( "%s") would do.  */
+
+static void get_desig( char *desig, const char *line, size_t len)
+{
+   size_t i = 0, n = 0;
+
+   if( len > 12)
+      len = 12;
+   while( i < len && isspace( (unsigned char)line[i]))
+      i++;
+   while( i < len && !isspace( (unsigned char)line[i]))
+      desig[n++] = line[i++];
+   desig[n] = '\0';
+}
+
+typedef struct
+{
+   size_t offset, len;
+   int obj;
+} match_t;
+
+/* With -p,  we note where each matching line is during the pass
+through the astrometry;  then,  for each object,  we open its file
+and write out its lines.  That avoids having thousands of files open
+at once.  Matches are bucketed by object with a counting sort,  which
+keeps them in file order within each object.  */
+
+static int write_per_object_files( const desig_set_t *set,
+            const char *data, const match_t *matches, const size_t n_matches,
+            const char *prefix)
+{
+   size_t *start = (size_t *)calloc( set->n_desigs + 1, sizeof( size_t));
+   size_t *order = (size_t *)malloc( (n_matches + 1) * sizeof( size_t));
+   size_t i;
+   unsigned obj;
+
+   if( !start || !order)
+      return( -1);
+   for( i = 0; i < n_matches; i++)
+      start[matches[i].obj + 1]++;
+   for( obj = 0; obj < set->n_desigs; obj++)
+      start[obj + 1] += start[obj];
+   for( i = 0; i < n_matches; i++)
+      order[start[matches[i].obj]++] = i;
+   for( obj = 0, i = 0; obj < set->n_desigs; obj++)
+      if( i < start[obj])
+         {
+         char filename[300];
+         FILE *ofile;
+
+         snprintf( filename, sizeof( filename), "%s%s.txt", prefix,
+                           set->desigs + obj * DESIG_LEN);
+         ofile = fopen( filename, "wb");
+         if( !ofile)
+            {
+            perror( filename);
+            return( -1);
+            }
+         for( ; i < start[obj]; i++)
+            fwrite( data + matches[order[i]].offset, matches[order[i]].len,
+                           1, ofile);
+         fclose( ofile);
+         }
+   free( start);
+   free( order);
+   return( 0);
+}
 
 int main( const int argc, const char **argv)
 {
-   FILE *ifile;
-   char buff[200], *desigs = NULL;
-   char prev_desig[13];
-   int it_matches = 0;
-   unsigned i, n_desigs = 0;
-   const unsigned desig_len = 13;   /* 12 bytes plus a trailing nul */
-
-   if( argc < 3)
+   FILE *ifile, *offset_file = NULL;
+   char buff[200], curr_desig[DESIG_LEN];
+   const char *filenames[2], *per_object_prefix = NULL;
+   const char *prev_line = NULL;
+   int obj = -1, run_obj = -1, n_files = 0;
+   unsigned i;
+   size_t loc = 0, run_start = 0, run_len = 0, n_matches = 0;
+   desig_set_t set;
+   mapped_file_t mf;
+   match_t *matches = NULL;
+
+   for( i = 1; i < (unsigned)argc; i++)
+      if( argv[i][0] != '-')
+         {
+         if( n_files < 2)
+            filenames[n_files++] = argv[i];
+         }
+      else if( argv[i][1] == 'p')
+         per_object_prefix = argv[i] + 2;
+      else if( argv[i][1] == 'o')
+         {
+         offset_file = fopen( argv[i] + 2, "wb");
+         if( !offset_file)
+            {
+            perror( argv[i] + 2);
+            error_exit( );
+            }
+         }
+   if( n_files < 2)
       error_exit( );
-   ifile = fopen( argv[1], "rb");
+   ifile = fopen( filenames[0], "rb");
    if( !ifile)
       {
-      fprintf( stderr, "Couldn't open '%s' :", argv[1]);
+      fprintf( stderr, "Couldn't open '%s' :", filenames[0]);
       perror( NULL);
       error_exit( );
       }
+   memset( &set, 0, sizeof( set));
    while( fgets( buff, sizeof( buff), ifile))
       if( *buff != '#')             /* both temp and permanent desigs */
          {
          char tdesig[20];
 
          buff[12] = '\0';
+         *tdesig = '\0';
          sscanf( buff, "%s", tdesig);
          if( strlen( tdesig) == 12)
             {
-            n_desigs++;
-            if( IS_POWER_OF_TWO( n_desigs))
-               desigs = (char *)realloc( desigs, n_desigs * 2 * desig_len);
-            strcpy( desigs + (n_desigs - 1) * desig_len, tdesig + 5);
+            add_desig( &set, tdesig + 5);
             tdesig[5] = '\0';
             }
-         n_desigs++;
-         if( IS_POWER_OF_TWO( n_desigs))
-            desigs = (char *)realloc( desigs, n_desigs * 2 * desig_len);
-         strcpy( desigs + (n_desigs - 1) * desig_len, tdesig);
+         if( *tdesig)
+            add_desig( &set, tdesig);
          }
    fclose( ifile);
-   if( !n_desigs)
+   if( !set.n_desigs)
       {
-      printf( "No designations found in '%s'\n", argv[1]);
+      printf( "No designations found in '%s'\n", filenames[0]);
       error_exit( );
       }
-   qsort( desigs, n_desigs, desig_len, compare);
-   for( i = 0; i < n_desigs; i++)
-      printf( "(%u) '%s'\n", i, desigs + i * desig_len);
-   ifile = fopen( argv[2], "rb");
-   if( !ifile)
+   for( i = 0; i < set.n_desigs; i++)
+      printf( "(%u) '%s'\n", i, set.desigs + i * DESIG_LEN);
+   if( map_file( &mf, filenames[1], 0))
       {
-      fprintf( stderr, "Couldn't open '%s' :", argv[2]);
+      fprintf( stderr, "Couldn't open '%s' :", filenames[1]);
       perror( NULL);
       error_exit( );
       }
-   memset( prev_desig, 0, sizeof( prev_desig));
-   while( fgets( buff, sizeof( buff), ifile))
+   while( loc < mf.len)
       {
-      if( memcmp( prev_desig, buff, 12))
-         {
-         char tdesig[20], tchar = buff[12];
+      const char *line = mf.data + loc;
+      const char *eol = (const char *)memchr( line, '\n', mf.len - loc);
+      const size_t len = (eol ? (size_t)( eol - line) + 1 : mf.len - loc);
 
-         buff[12] = '\0';
-         sscanf( buff, "%s", tdesig);
-         it_matches = (NULL != bsearch( tdesig, desigs, n_desigs, desig_len, compare));
-         buff[12] = tchar;
+      if( !prev_line || len < 12 || memcmp( prev_line, line, 12))
+         {
+         get_desig( curr_desig, line, len);
+         obj = find_desig( &set, curr_desig);
+         prev_line = (len >= 12 ? line : NULL);
          }
-      if( it_matches)
-         printf( "%s", buff);
+      if( obj >= 0)
+         {
+         if( per_object_prefix)
+            {
+            n_matches++;
+            if( IS_POWER_OF_TWO( n_matches))
+               matches = (match_t *)realloc( matches,
+                                 2 * n_matches * sizeof( match_t));
+            matches[n_matches - 1].offset = loc;
+            matches[n_matches - 1].len = len;
+            matches[n_matches - 1].obj = obj;
+            }
+         else
+            fwrite( line, len, 1, stdout);
+         }
+      if( offset_file && (obj != run_obj || obj < 0))
+         {              /* end of a run of lines for one object */
+         if( run_obj >= 0)
+            fprintf( offset_file, "%s %lu %lu\n", set.desigs + run_obj * DESIG_LEN,
+                           (unsigned long)run_start, (unsigned long)run_len);
+         run_obj = obj;
+         run_start = loc;
+         run_len = 0;
+         }
+      run_len++;
+      loc += len;
       }
-   fclose( ifile);
-   free( desigs);
+   if( offset_file)
+      {
+      if( run_obj >= 0)
+         fprintf( offset_file, "%s %lu %lu\n", set.desigs + run_obj * DESIG_LEN,
+                           (unsigned long)run_start, (unsigned long)run_len);
+      fclose( offset_file);
+      }
+   if( per_object_prefix && write_per_object_files( &set, mf.data,
+                        matches, n_matches, per_object_prefix))
+      fprintf( stderr, "Couldn't write per-object files\n");
+   unmap_file( &mf);
+   free( matches);
+   free( set.desigs);
+   free( set.slots);
    return( 0);
 }
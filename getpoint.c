@@ -22,21 +22,614 @@ be cut short or extended as desired;  for example,
 
    would get you all fields after the specified time on 2020 Mar 14.
 (Well,  at least until 3000 January 1... making the last parameter
-'a' instead of '3' would solve even that problem.)    */
+'a' instead of '3' would solve even that problem.)
+
+   That's a full pass through the file for each query.  For many queries,
+first run
+
+./getpoint -i css_nightly.csv
+
+   to write an index,  css_nightly.csv.idx.  That's a binary table with
+one entry per field :  time (as MJD and as the original string),  RA,
+dec,  field size,  exposure time,  and where the line is in the CSV file,
+sorted by time.  Queries then binary-search the index for the time range,
+and output the matching lines (in the order they're in the file,  just as
+with a full pass).  If the CSV file has changed since it was indexed,  we
+fall back to the full pass.  The time must be in the third column;  the
+columns for RA,  dec,  field size and exposure time (counting from zero)
+default to 3, 4, 5, 6,  and can be set with,  e.g.,  '-f4,5,6,7'.
+
+   '-i' also writes a spatial index,  css_nightly.csv.sidx,  for finding
+which fields may have covered a given point at a given time,  as in
+
+./getpoint css_nightly.csv -r 123.45,-6.789,0.5 2019-05-01 2019-05-07
+
+   which would list fields from that week that came within half a degree
+of RA=123.45,  dec=-6.789 (all in degrees;  times can also be MJDs;  with
+one time,  we look at the 24 hours after it).  The sky is cut into one-
+degree bands of declination,  and each band into cells about a degree
+wide in RA (fewer toward the poles,  so cells are of roughly equal area).
+Each field is put in the cell holding its center,  and the index lists
+fields sorted by cell and then by time.  A query finds the cells that
+could hold the center of a field overlapping the search circle,  and
+for each,  binary-searches the time range.  Remaining fields are checked
+against the actual distance,  treating each field as a circle enclosing
+a square of the given size.  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <math.h>
 #include <assert.h>
+#include <sys/stat.h>
+#include "mapfile.h"
+
+#define IDX_MAGIC "GETPTIDX"
+#define TIME_LEN 32
+
+typedef struct
+{
+   char magic[8];
+   uint64_t n_fields, file_size, file_mtime;
+} idx_header_t;
+
+typedef struct
+{
+   double mjd, ra, dec, size, exposure;
+   uint64_t offset;
+   char time[TIME_LEN];    /* start of third column,  nul-terminated */
+} field_t;
+
+/* Copies column 'n' (counting from zero) of a CSV line into 'obuff'.
+Returns a pointer to the start of that column,  or NULL if the line
+doesn't have that many columns. */
+
+static const char *get_csv_column( char *obuff, const size_t obuff_size,
+                  const char *line, const size_t len, int n)
+{
+   size_t i = 0, j = 0;
+
+   while( n && i < len)
+      if( line[i++] == ',')
+         n--;
+   if( n)
+      return( NULL);
+   while( i + j < len && line[i + j] != ',' && line[i + j] != '\n'
+                  && j < obuff_size - 1)
+      {
+      obuff[j] = line[i + j];
+      j++;
+      }
+   obuff[j] = '\0';
+   return( line + i);
+}
+
+/* Parses,  e.g.,  '2020-03-14T15:26:53.589' (or a space in place of the
+'T',  or with the time cut short) to an MJD.  Returns 0. if it can't. */
+
+static double iso_time_to_mjd( const char *str)
+{
+   int year, month, day, hour = 0, min = 0;
+   double sec = 0.;
+   long y, m, jdn;
+
+   if( sscanf( str, "%d-%d-%d%*c%d:%d:%lf", &year, &month, &day,
+                     &hour, &min, &sec) < 3)
+      return( 0.);
+   y = year + 4800L - (14 - month) / 12;     /* Gregorian calendar */
+   m = month + 12L * ((14 - month) / 12) - 3;
+   jdn = day + (153L * m + 2) / 5 + 365L * y + y / 4 - y / 100 + y / 400 - 32045L;
+   return( (double)( jdn - 2400001L) + ((double)hour + (double)min / 60.
+                                        + sec / 3600.) / 24.);
+}
+
+static int field_compare( const void *a, const void *b)
+{
+   const field_t *f1 = (const field_t *)a, *f2 = (const field_t *)b;
+   const int rval = strcmp( f1->time, f2->time);
+
+   if( rval)
+      return( rval);
+   return( f1->offset < f2->offset ? -1 : (f1->offset > f2->offset ? 1 : 0));
+}
+
+#define SIDX_MAGIC "GETPTSPX"
+#define N_BANDS 180
+#define PI 3.1415926535897932384626433832795028841971693993751058209749445923
+
+typedef struct
+{
+   char magic[8];
+   uint64_t n_entries, file_size, file_mtime;
+   double max_radius;      /* largest field radius,  in degrees */
+} sidx_header_t;
+
+typedef struct
+{
+   uint32_t cell, field;      /* 'field' indexes the time-sorted list */
+   double mjd;
+} cell_entry_t;
+
+static int n_ra_cells( const int band)
+{
+   const double dec = -90. + (double)band + .5;
+   const int rval = (int)( 360. * cos( dec * PI / 180.));
+
+   return( rval < 1 ? 1 : rval);
+}
+
+static uint32_t band_start[N_BANDS + 1];
+
+static void init_cells( void)
+{
+   int band;
+
+   band_start[0] = 0;
+   for( band = 0; band < N_BANDS; band++)
+      band_start[band + 1] = band_start[band] + (uint32_t)n_ra_cells( band);
+}
+
+static int dec_to_band( const double dec)
+{
+   const int band = (int)floor( dec + 90.);
+
+   return( band < 0 ? 0 : (band >= N_BANDS ? N_BANDS - 1 : band));
+}
+
+static int ra_to_segment( double ra, const int n_segments)
+{
+   int rval;
+
+   ra = fmod( ra, 360.);
+   if( ra < 0.)
+      ra += 360.;
+   rval = (int)( ra * (double)n_segments / 360.);
+   return( rval >= n_segments ? n_segments - 1 : rval);
+}
+
+static double field_radius( const field_t *f)
+{
+   return( f->size * sqrt( .5));       /* half the diagonal of a square */
+}
+
+/* Angular distance between two points,  in degrees (haversine formula) */
+
+static double angular_distance( const double ra1, const double dec1,
+                                const double ra2, const double dec2)
+{
+   const double d2r = PI / 180.;
+   const double sin_ddec = sin( (dec2 - dec1) * d2r / 2.);
+   const double sin_dra = sin( (ra2 - ra1) * d2r / 2.);
+   double h = sin_ddec * sin_ddec
+               + cos( dec1 * d2r) * cos( dec2 * d2r) * sin_dra * sin_dra;
+
+   if( h > 1.)
+      h = 1.;
+   return( 2. * asin( sqrt( h)) / d2r);
+}
+
+static int cell_entry_compare( const void *a, const void *b)
+{
+   const cell_entry_t *e1 = (const cell_entry_t *)a;
+   const cell_entry_t *e2 = (const cell_entry_t *)b;
+
+   if( e1->cell != e2->cell)
+      return( e1->cell < e2->cell ? -1 : 1);
+   if( e1->mjd != e2->mjd)
+      return( e1->mjd < e2->mjd ? -1 : 1);
+   return( e1->field < e2->field ? -1 : (e1->field > e2->field ? 1 : 0));
+}
+
+static int write_spatial_index( const char *filename, const field_t *fields,
+                        const size_t n_fields, const struct stat *st)
+{
+   cell_entry_t *entries = (cell_entry_t *)malloc(
+                                 (n_fields + 1) * sizeof( cell_entry_t));
+   char idx_name[300];
+   sidx_header_t hdr;
+   size_t i;
+   FILE *ofile;
+
+   assert( entries);
+   memset( &hdr, 0, sizeof( hdr));
+   memcpy( hdr.magic, SIDX_MAGIC, 8);
+   hdr.n_entries = (uint64_t)n_fields;
+   hdr.file_size = (uint64_t)st->st_size;
+   hdr.file_mtime = (uint64_t)st->st_mtime;
+   for( i = 0; i < n_fields; i++)
+      {
+      const int band = dec_to_band( fields[i].dec);
+
+      entries[i].cell = band_start[band]
+                  + (uint32_t)ra_to_segment( fields[i].ra, n_ra_cells( band));
+      entries[i].field = (uint32_t)i;
+      entries[i].mjd = fields[i].mjd;
+      if( hdr.max_radius < field_radius( fields + i))
+         hdr.max_radius = field_radius( fields + i);
+      }
+   qsort( entries, n_fields, sizeof( cell_entry_t), cell_entry_compare);
+   snprintf( idx_name, sizeof( idx_name), "%s.sidx", filename);
+   ofile = fopen( idx_name, "wb");
+   if( !ofile)
+      {
+      perror( idx_name);
+      free( entries);
+      return( -1);
+      }
+   fwrite( &hdr, sizeof( hdr), 1, ofile);
+   fwrite( entries, sizeof( cell_entry_t), n_fields, ofile);
+   fclose( ofile);
+   free( entries);
+   return( 0);
+}
+
+static int write_index( const char *filename, const int *columns)
+{
+   mapped_file_t mf;
+   field_t *fields = NULL;
+   size_t n_fields = 0, loc = 0, i;
+   char idx_name[300];
+   idx_header_t hdr;
+   struct stat st;
+   FILE *ofile;
+
+   if( map_file( &mf, filename, 0) || stat( filename, &st))
+      {
+      perror( filename);
+      return( -1);
+      }
+   while( loc < mf.len)
+      {
+      const char *line = mf.data + loc;
+      const char *eol = (const char *)memchr( line, '\n', mf.len - loc);
+      const size_t len = (eol ? (size_t)( eol - line) + 1 : mf.len - loc);
+      char buff[TIME_LEN];
+      const char *tptr = get_csv_column( buff, sizeof( buff), line, len, 2);
+
+      if( tptr)
+         {
+         field_t *f;
+         double *vals[4];
+
+         n_fields++;
+         if( !((n_fields - 1) % 65536))
+            fields = (field_t *)realloc( fields,
+                                 (n_fields + 65535) * sizeof( field_t));
+         assert( fields);
+         f = fields + n_fields - 1;
+         memset( f, 0, sizeof( field_t));
+         f->mjd = iso_time_to_mjd( buff);
+         f->offset = (uint64_t)loc;
+         for( i = 0; i < TIME_LEN - 1 && tptr + i < line + len; i++)
+            f->time[i] = tptr[i];
+         vals[0] = &f->ra;
+         vals[1] = &f->dec;
+         vals[2] = &f->size;
+         vals[3] = &f->exposure;
+         for( i = 0; i < 4; i++)
+            if( get_csv_column( buff, sizeof( buff), line, len, columns[i]))
+               *vals[i] = atof( buff);
+         }
+      loc += len;
+      }
+   qsort( fields, n_fields, sizeof( field_t), field_compare);
+   memset( &hdr, 0, sizeof( hdr));
+   memcpy( hdr.magic, IDX_MAGIC, 8);
+   hdr.n_fields = (uint64_t)n_fields;
+   hdr.file_size = (uint64_t)st.st_size;
+   hdr.file_mtime = (uint64_t)st.st_mtime;
+   snprintf( idx_name, sizeof( idx_name), "%s.idx", filename);
+   ofile = fopen( idx_name, "wb");
+   if( !ofile)
+      {
+      perror( idx_name);
+      return( -1);
+      }
+   fwrite( &hdr, sizeof( hdr), 1, ofile);
+   fwrite( fields, sizeof( field_t), n_fields, ofile);
+   fclose( ofile);
+   printf( "%lu fields indexed in '%s'\n", (unsigned long)n_fields, idx_name);
+   i = write_spatial_index( filename, fields, n_fields, &st);
+   free( fields);
+   unmap_file( &mf);
+   return( (int)i);
+}
+
+/* Returns the fields if there's an index for 'filename' matching its
+current size and modification time;  otherwise,  NULL.  */
+
+static const field_t *load_index( mapped_file_t *mf, const char *filename,
+                                  size_t *n_fields)
+{
+   char idx_name[300];
+   idx_header_t hdr;
+   struct stat st;
+
+   snprintf( idx_name, sizeof( idx_name), "%s.idx", filename);
+   if( map_file( mf, idx_name, 0))
+      return( NULL);
+   if( mf->len >= sizeof( hdr))
+      memcpy( &hdr, mf->data, sizeof( hdr));
+   if( mf->len >= sizeof( hdr) && !memcmp( hdr.magic, IDX_MAGIC, 8)
+            && mf->len == sizeof( hdr) + hdr.n_fields * sizeof( field_t)
+            && !stat( filename, &st) && hdr.file_size == (uint64_t)st.st_size
+            && hdr.file_mtime == (uint64_t)st.st_mtime)
+      {
+      *n_fields = (size_t)hdr.n_fields;
+      return( (const field_t *)( mf->data + sizeof( hdr)));
+      }
+   fprintf( stderr, "'%s' is out of date;  not using it\n", idx_name);
+   unmap_file( mf);
+   return( NULL);
+}
+
+/* Since the fields are sorted by their time strings,  'time >= date1'
+and 'time <= date2' (in the strncmp() sense used below) each hold for
+a contiguous range of fields,  and we can binary-search for the ends.
+If 'upper' is set,  we find the first field past date2;  otherwise,  the
+first field at or past date1.  */
+
+static size_t find_time( const field_t *fields, const size_t n_fields,
+                  const char *date, const int upper)
+{
+   const size_t len = strlen( date);
+   size_t lo = 0, hi = n_fields;
+
+   while( lo < hi)
+      {
+      const size_t mid = (lo + hi) / 2;
+      const int compare = strncmp( fields[mid].time, date, len);
+
+      if( upper ? compare <= 0 : compare < 0)
+         lo = mid + 1;
+      else
+         hi = mid;
+      }
+   return( lo);
+}
+
+static int offset_compare( const void *a, const void *b)
+{
+   const uint64_t o1 = *(const uint64_t *)a, o2 = *(const uint64_t *)b;
+
+   return( o1 < o2 ? -1 : (o1 > o2 ? 1 : 0));
+}
+
+/* Writes out the lines at the given offsets,  in file order. */
+
+static void write_lines( const mapped_file_t *mf, uint64_t *offsets,
+                         const size_t n_offsets)
+{
+   size_t i;
+
+   qsort( offsets, n_offsets, sizeof( uint64_t), offset_compare);
+   for( i = 0; i < n_offsets; i++)
+      {
+      const char *line = mf->data + offsets[i];
+      const char *eol = (const char *)memchr( line, '\n',
+                              mf->len - (size_t)offsets[i]);
+
+      fwrite( line, eol ? (size_t)( eol - line) + 1 : mf->len - (size_t)offsets[i],
+                              1, stdout);
+      }
+}
+
+static int indexed_search( const char *filename, const char *date1,
+                           const char *date2)
+{
+   mapped_file_t idx_mf, mf;
+   size_t n_fields, start, end, i;
+   const field_t *fields = load_index( &idx_mf, filename, &n_fields);
+   uint64_t *offsets;
+
+   if( !fields)
+      return( -1);
+   if( map_file( &mf, filename, 0))
+      {
+      unmap_file( &idx_mf);
+      return( -1);
+      }
+   start = find_time( fields, n_fields, date1, 0);
+   end = find_time( fields, n_fields, date2, 1);
+   if( end < start)
+      end = start;
+   offsets = (uint64_t *)malloc( (end - start + 1) * sizeof( uint64_t));
+   assert( offsets);
+   for( i = start; i < end; i++)
+      offsets[i - start] = fields[i].offset;
+   write_lines( &mf, offsets, end - start);
+   free( offsets);
+   unmap_file( &mf);
+   unmap_file( &idx_mf);
+   return( 0);
+}
+
+static const cell_entry_t *load_spatial_index( mapped_file_t *mf,
+            const char *filename, sidx_header_t *hdr)
+{
+   char idx_name[300];
+   struct stat st;
+
+   snprintf( idx_name, sizeof( idx_name), "%s.sidx", filename);
+   if( map_file( mf, idx_name, 0))
+      return( NULL);
+   if( mf->len >= sizeof( sidx_header_t))
+      memcpy( hdr, mf->data, sizeof( sidx_header_t));
+   if( mf->len >= sizeof( sidx_header_t) && !memcmp( hdr->magic, SIDX_MAGIC, 8)
+            && mf->len == sizeof( sidx_header_t)
+                              + hdr->n_entries * sizeof( cell_entry_t)
+            && !stat( filename, &st) && hdr->file_size == (uint64_t)st.st_size
+            && hdr->file_mtime == (uint64_t)st.st_mtime)
+      return( (const cell_entry_t *)( mf->data + sizeof( sidx_header_t)));
+   unmap_file( mf);
+   return( NULL);
+}
+
+/* First entry in cell 'cell' at or after 'mjd' */
+
+static size_t find_cell_entry( const cell_entry_t *entries, const size_t n,
+                  const uint32_t cell, const double mjd)
+{
+   size_t lo = 0, hi = n;
+
+   while( lo < hi)
+      {
+      const size_t mid = (lo + hi) / 2;
+
+      if( entries[mid].cell < cell
+                  || (entries[mid].cell == cell && entries[mid].mjd < mjd))
+         lo = mid + 1;
+      else
+         hi = mid;
+      }
+   return( lo);
+}
+
+/* Finds fields between mjd1 and mjd2 that may have covered any point
+within 'radius' degrees of (ra, dec).  Their indices in the time-sorted
+list are stored in 'hits' (which must have room for all fields);  the
+number found is returned. */
+
+static size_t find_fields_near( const cell_entry_t *entries,
+            const sidx_header_t *hdr, const field_t *fields,
+            const double ra, const double dec, const double radius,
+            const double mjd1, const double mjd2, uint32_t *hits)
+{
+   const double search_radius = radius + hdr->max_radius;
+   const double sin_r = sin( search_radius * PI / 180.);
+   const double cos_dec = cos( dec * PI / 180.);
+   const int band1 = dec_to_band( dec - search_radius);
+   const int band2 = dec_to_band( dec + search_radius);
+   double delta_ra;     /* half-width in RA of the search circle */
+   size_t n_hits = 0;
+   int band;
+
+   if( search_radius >= 90. || sin_r >= cos_dec)
+      delta_ra = 180.;        /* circle includes a pole */
+   else
+      delta_ra = asin( sin_r / cos_dec) * 180. / PI;
+   for( band = band1; band <= band2; band++)
+      {
+      const int n_segs = n_ra_cells( band);
+      int seg1 = ra_to_segment( ra - delta_ra, n_segs);
+      int n_cells = ra_to_segment( ra + delta_ra, n_segs) - seg1;
+      int i;
+
+      if( n_cells < 0)              /* wrapped around RA=0 */
+         n_cells += n_segs;
+      n_cells++;
+      if( delta_ra >= 180. || n_cells > n_segs)
+         {
+         seg1 = 0;
+         n_cells = n_segs;
+         }
+      for( i = 0; i < n_cells; i++)
+         {
+         const uint32_t cell = band_start[band] + (uint32_t)( (seg1 + i) % n_segs);
+         size_t j = find_cell_entry( entries, (size_t)hdr->n_entries,
+                                       cell, mjd1);
+
+         for( ; j < hdr->n_entries && entries[j].cell == cell
+                           && entries[j].mjd <= mjd2; j++)
+            {
+            const field_t *f = fields + entries[j].field;
+
+            if( angular_distance( ra, dec, f->ra, f->dec)
+                              <= radius + field_radius( f))
+               hits[n_hits++] = entries[j].field;
+            }
+         }
+      }
+   return( n_hits);
+}
+
+/* Times for '-r' can be given as MJDs or as ISO dates */
+
+static double get_mjd( const char *str)
+{
+   return( strchr( str + 1, '-') ? iso_time_to_mjd( str) : atof( str));
+}
+
+static int spatial_search( const char *filename, const char *position,
+                  const char *date1, const char *date2)
+{
+   mapped_file_t idx_mf, sidx_mf, mf;
+   sidx_header_t hdr;
+   size_t n_fields, n_hits, i;
+   const field_t *fields = load_index( &idx_mf, filename, &n_fields);
+   const cell_entry_t *entries;
+   double ra, dec, radius, mjd1 = get_mjd( date1), mjd2;
+   uint32_t *hits;
+   uint64_t *offsets;
+
+   if( !fields)
+      {
+      fprintf( stderr, "'%s' must be indexed first (use '-i')\n", filename);
+      return( -1);
+      }
+   entries = load_spatial_index( &sidx_mf, filename, &hdr);
+   if( !entries || hdr.n_entries != n_fields || map_file( &mf, filename, 0))
+      {
+      fprintf( stderr, "'%s' must be re-indexed (use '-i')\n", filename);
+      unmap_file( &idx_mf);
+      if( entries)
+         unmap_file( &sidx_mf);
+      return( -1);
+      }
+   if( sscanf( position, "%lf,%lf,%lf", &ra, &dec, &radius) != 3)
+      {
+      fprintf( stderr, "Position should be given as RA,dec,radius\n");
+      return( -1);
+      }
+   mjd2 = (date2 ? get_mjd( date2) : mjd1 + 1.);
+   hits = (uint32_t *)malloc( (n_fields + 1) * sizeof( uint32_t));
+   offsets = (uint64_t *)malloc( (n_fields + 1) * sizeof( uint64_t));
+   assert( hits && offsets);
+   n_hits = find_fields_near( entries, &hdr, fields, ra, dec, radius,
+                                 mjd1, mjd2, hits);
+   for( i = 0; i < n_hits; i++)
+      offsets[i] = fields[hits[i]].offset;
+   write_lines( &mf, offsets, n_hits);
+   free( hits);
+   free( offsets);
+   unmap_file( &mf);
+   unmap_file( &sidx_mf);
+   unmap_file( &idx_mf);
+   return( 0);
+}
 
 int main( const int argc, const char **argv)
 {
-   FILE *ifile = fopen( argv[1], "rb");
+   FILE *ifile;
    char buff[200];
+   int columns[4] = { 3, 4, 5, 6 }, i, make_index = 0, n_args = 0;
+   const char *args[4], *position = NULL;
 
+   init_cells( );
+   for( i = 1; i < argc; i++)
+      if( argv[i][0] == '-' && argv[i][1] == 'i' && !argv[i][2])
+         make_index = 1;
+      else if( argv[i][0] == '-' && argv[i][1] == 'r')
+         position = (argv[i][2] || i == argc - 1 ? argv[i] + 2 : argv[++i]);
+      else if( argv[i][0] == '-' && argv[i][1] == 'f')
+         sscanf( argv[i] + 2, "%d,%d,%d,%d", columns, columns + 1,
+                              columns + 2, columns + 3);
+      else if( n_args < 3)
+         args[n_args++] = argv[i];
+   assert( n_args > 0);
+   if( make_index)
+      return( write_index( args[0], columns));
+   assert( n_args > 1);
+   if( position)
+      return( spatial_search( args[0], position, args[1],
+                                    n_args > 2 ? args[2] : NULL));
+   if( n_args == 2)             /* only one date given */
+      args[2] = args[1];
+   if( !indexed_search( args[0], args[1], args[2]))
+      return( 0);
+   ifile = fopen( args[0], "rb");
    assert( ifile);
-   assert( argc > 2);
-   if( argc == 3)             /* only one date given */
-      argv[3] = argv[2];
    while( fgets( buff, sizeof( buff), ifile))
       {
       char *tptr = strchr( buff, ',');
@@ -45,8 +638,8 @@ int main( const int argc, const char **argv)
          tptr = strchr( tptr + 1, ',');
       assert( tptr);
       tptr++;
-      if( strncmp( tptr, argv[2], strlen( argv[2])) >= 0 &&
-          strncmp( tptr, argv[3], strlen( argv[3])) <= 0)
+      if( strncmp( tptr, args[1], strlen( args[1])) >= 0 &&
+          strncmp( tptr, args[2], strlen( args[2])) <= 0)
          printf( "%s", buff);
       }
    fclose( ifile);
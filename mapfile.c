@@ -0,0 +1,100 @@
+/* Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mapfile.h"
+
+#ifndef _WIN32
+   #include <fcntl.h>
+   #include <unistd.h>
+   #include <sys/mman.h>
+   #include <sys/stat.h>
+#endif
+
+/* The large MPC astrometry files (UnnObs.txt,  NumObs.txt,  etc.) run
+to gigabytes.  Reading them into a malloc()ed buffer means that much
+RAM is committed for the life of the program.  Mapping them instead
+lets the OS page data in as needed (and drop it again under memory
+pressure),  and copy-on-write lets us modify a few records in place
+without copying the whole file.   */
+
+int map_file( mapped_file_t *mf, const char *filename, const int copy_on_write)
+{
+#ifndef _WIN32
+   struct stat st;
+   const int fd = open( filename, O_RDONLY);
+
+   memset( mf, 0, sizeof( mapped_file_t));
+   if( fd < 0)
+      return( -1);
+   if( fstat( fd, &st))
+      {
+      close( fd);
+      return( -1);
+      }
+   mf->len = (size_t)st.st_size;
+   if( mf->len)         /* mmap() of zero bytes fails */
+      {
+      void *addr = mmap( NULL, mf->len,
+                   PROT_READ | (copy_on_write ? PROT_WRITE : 0),
+                   MAP_PRIVATE, fd, 0);
+
+      if( addr == MAP_FAILED)
+         {
+         close( fd);
+         return( -1);
+         }
+      mf->data = (char *)addr;
+      mf->is_mapped = 1;
+      }
+   close( fd);       /* the mapping stays valid after the close */
+   return( 0);
+#else
+   FILE *ifile = fopen( filename, "rb");
+
+   memset( mf, 0, sizeof( mapped_file_t));
+   if( !ifile)
+      return( -1);
+   fseek( ifile, 0L, SEEK_END);
+   mf->len = (size_t)ftell( ifile);
+   fseek( ifile, 0L, SEEK_SET);
+   mf->data = (char *)malloc( mf->len + 1);
+   if( !mf->data || fread( mf->data, 1, mf->len, ifile) != mf->len)
+      {
+      free( mf->data);
+      mf->data = NULL;
+      fclose( ifile);
+      return( -1);
+      }
+   fclose( ifile);
+   (void)copy_on_write;       /* buffer is always writable */
+   return( 0);
+#endif
+}
+
+void unmap_file( mapped_file_t *mf)
+{
+#ifndef _WIN32
+   if( mf->is_mapped)
+      munmap( mf->data, mf->len);
+#else
+   free( mf->data);
+#endif
+   memset( mf, 0, sizeof( mapped_file_t));
+}
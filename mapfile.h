@@ -0,0 +1,48 @@
+#ifndef MAPFILE_H_INCLUDED
+#define MAPFILE_H_INCLUDED
+
+/* mapfile.h: header file for read-only/copy-on-write file mapping
+Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.    */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* #ifdef __cplusplus */
+
+typedef struct
+   {
+   char *data;
+   size_t len;
+   int is_mapped;       /* 0 if we fell back to malloc() and fread() */
+   } mapped_file_t;
+
+   /* map_file() returns 0 on success.  If 'copy_on_write' is non-zero,
+      the data can be modified in memory;  changes are never written
+      back to the file,  and (on systems with mmap()) only the pages you
+      actually touch get private copies.  On systems without mmap(),  the
+      file is simply read into a malloc()ed buffer.  */
+
+int map_file( mapped_file_t *mf, const char *filename, const int copy_on_write);
+void unmap_file( mapped_file_t *mf);
+
+#ifdef __cplusplus
+}
+#endif  /* #ifdef __cplusplus */
+
+#endif  /* #ifndef MAPFILE_H_INCLUDED */
@@ -19,6 +19,18 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include "mapfile.h"
+#include "mpc_key.h"
+
+#ifndef _WIN32
+   #include <signal.h>
+   #include <unistd.h>
+   #include <sys/socket.h>
+   #include <sys/un.h>
+#endif
 
 /* Code to extract observations for a specific object from the large
 MPC 80-column astrometry files (UnnObs.txt,  CmtObs.txt,  SatObs.txt,
@@ -26,7 +38,44 @@ NumObs.txt,  itf.txt).  These files contain only 80-column data,  are
 always a multiple of 81 bytes (including the line feed at the end of
 each line),  and are sorted by packed ID.  So if you want a particular
 object,  you can just binary-search to find the first record,  then
-start reading until you've gotten all the records.    */
+start reading until you've gotten all the records.
+
+   The files are memory-mapped,  so those searches are done in memory,
+with the OS paging in only the parts of the file we actually touch.
+'mpc_extr UnnObs.txt -index' will write
+a sidecar file,  'UnnObs.txt.idx',  listing each distinct 12-byte packed
+ID with the record number of its first record and the number of records.
+If that index exists and is up to date (the file size and modification
+time stored in it match those of the file),  an extraction is just a
+binary search in the memory-mapped index and one contiguous copy.  If the
+file has changed since the index was made,  we warn and fall back to the
+usual search.  The index is in native byte order;  it's meant to live
+next to the file on the machine that made it.
+
+   For many objects,  '-l(file)' reads a list of designations,  sorts them
+into file order,  and walks through them,  starting each search from
+where the last object ended (see gallop_search()).
+
+   Several files can be given,  separated by commas (or '-a' for all of
+NumObs.txt,  UnnObs.txt,  CmtObs.txt and itf.txt,  whichever exist).  Each
+file is searched in its own thread,  and each object's records from all
+the files are merged into one stream,  in the usual sort order (see
+mpc_key.c).
+
+   Programs that extract objects all day can instead leave a copy of
+mpc_extr running as a daemon,  with the files (and indexes) mapped:
+
+./mpc_extr NumObs.txt,UnnObs.txt -d/tmp/obs.sock
+
+   and get objects from it with
+
+./mpc_extr -c/tmp/obs.sock K14A00A K13YD3F
+
+   (or by writing designations,  one per line,  to the socket;  each one
+gets back its records,  followed by an empty line).  Before each query,
+the daemon stat()s the files;  if one has been replaced or modified,  it's
+mapped anew and the old mapping dropped.  (Replace files with rename(),
+so that the old mapping stays valid until then.)      */
 
 int mpc_compare( const char *str1, const char *str2)
 {
@@ -39,16 +88,157 @@ int mpc_compare( const char *str1, const char *str2)
    return( rval);
 }
 
-static char *err_fgets( char *buff, size_t nbytes, FILE *ifile)
+#define IDX_MAGIC "MPCIDX1"
+
+typedef struct
+{
+   char magic[8];
+   uint32_t recsize, n_entries;
+   uint64_t n_recs, file_size, file_mtime;
+} idx_header_t;
+
+typedef struct
+{
+   char desig[12];
+   uint32_t n_recs;
+   uint64_t first_rec;
+} idx_entry_t;
+
+/* The index is written to a temporary file,  then renamed to
+'(filename).idx',  so that a crash or a full disk can't leave a
+truncated index behind,  and a daemon (see below) that maps the index
+as soon as it changes never sees a half-written one.  */
+
+static int write_index( const char *data, const char *filename,
+                        const unsigned long recsize, const unsigned long n_recs)
 {
-   char *rval = fgets( buff, nbytes, ifile);
+   char idx_name[300], tmp_name[310];
+   idx_header_t hdr;
+   idx_entry_t entry;
+   unsigned long rec;
+   struct stat st;
+   FILE *ofile;
+   int n_errors = 0;
 
-   if( !rval)
+   snprintf( idx_name, sizeof( idx_name), "%.280s.idx", filename);
+   snprintf( tmp_name, sizeof( tmp_name), "%s.tmp", idx_name);
+   if( stat( filename, &st))
       {
-      perror( "fgets failed");
-      exit( -1);
+      perror( filename);
+      return( -1);
       }
-   return( rval);
+   ofile = fopen( tmp_name, "wb");
+   if( !ofile)
+      {
+      perror( tmp_name);
+      return( -1);
+      }
+   memset( &hdr, 0, sizeof( hdr));
+   memcpy( hdr.magic, IDX_MAGIC, sizeof( hdr.magic));
+   hdr.recsize = (uint32_t)recsize;
+   hdr.n_recs = (uint64_t)n_recs;
+   hdr.file_size = (uint64_t)st.st_size;
+   hdr.file_mtime = (uint64_t)st.st_mtime;
+   if( fwrite( &hdr, sizeof( hdr), 1, ofile) != 1)
+      n_errors++;
+   memset( &entry, 0, sizeof( entry));
+   for( rec = 0; rec < n_recs && !n_errors; rec++)
+      {
+      const char *tptr = data + rec * recsize;
+
+      if( !entry.n_recs || memcmp( entry.desig, tptr, 12))
+         {
+         if( entry.n_recs)
+            {
+            if( fwrite( &entry, sizeof( entry), 1, ofile) != 1)
+               n_errors++;
+            hdr.n_entries++;
+            }
+         memcpy( entry.desig, tptr, 12);
+         entry.first_rec = (uint64_t)rec;
+         entry.n_recs = 0;
+         }
+      entry.n_recs++;
+      }
+   if( entry.n_recs && !n_errors)
+      {
+      if( fwrite( &entry, sizeof( entry), 1, ofile) != 1)
+         n_errors++;
+      hdr.n_entries++;
+      }
+   if( fseek( ofile, 0L, SEEK_SET)
+               || fwrite( &hdr, sizeof( hdr), 1, ofile) != 1)
+      n_errors++;
+   if( fclose( ofile))
+      n_errors++;
+#ifdef _WIN32                 /* rename() won't replace a file here */
+   if( !n_errors)
+      remove( idx_name);
+#endif
+   if( n_errors || rename( tmp_name, idx_name))
+      {
+      perror( idx_name);
+      remove( tmp_name);
+      return( -1);
+      }
+   printf( "%lu records of %lu objects indexed in '%s'\n",
+               rec, (unsigned long)hdr.n_entries, idx_name);
+   return( 0);
+}
+
+/* Returns a pointer to the index entries (with the header filled in) if
+the index exists,  and matches the file;  otherwise,  NULL.  */
+
+static const idx_entry_t *load_index( mapped_file_t *mf, idx_header_t *hdr,
+                  const char *filename, const unsigned long recsize)
+{
+   char idx_name[300];
+   struct stat st;
+
+   snprintf( idx_name, sizeof( idx_name), "%.280s.idx", filename);
+   if( map_file( mf, idx_name, 0))
+      return( NULL);
+   if( mf->len >= sizeof( idx_header_t))
+      memcpy( hdr, mf->data, sizeof( idx_header_t));
+   if( mf->len < sizeof( idx_header_t) || memcmp( hdr->magic, IDX_MAGIC, 8)
+            || mf->len != sizeof( idx_header_t)
+                          + hdr->n_entries * sizeof( idx_entry_t)
+            || hdr->recsize != recsize)
+      fprintf( stderr, "'%s' isn't a valid index;  not using it\n", idx_name);
+   else if( stat( filename, &st) || hdr->file_size != (uint64_t)st.st_size
+                  || hdr->file_mtime != (uint64_t)st.st_mtime)
+      fprintf( stderr, "'%s' is out of date;  not using it\n", idx_name);
+   else
+      return( (const idx_entry_t *)( mf->data + sizeof( idx_header_t)));
+   unmap_file( mf);
+   return( NULL);
+}
+
+/* Binary-searches the index for the first entry matching 'target',  then
+adds up the records in all the matching entries (there can be several
+for a given target;  e.g.,  a comet with several components).  These are
+always contiguous in the file.  Returns the number of records found.  */
+
+static unsigned long index_lookup( const idx_entry_t *entries,
+            const unsigned long n_entries, const char *target,
+            unsigned long *first_rec)
+{
+   unsigned long lo = 0, hi = n_entries, n_found = 0;
+
+   while( lo < hi)
+      {
+      const unsigned long mid = (lo + hi) / 2;
+
+      if( mpc_compare( entries[mid].desig, target) < 0)
+         lo = mid + 1;
+      else
+         hi = mid;
+      }
+   if( lo < n_entries)
+      *first_rec = (unsigned long)entries[lo].first_rec;
+   while( lo < n_entries && !mpc_compare( entries[lo].desig, target))
+      n_found += entries[lo++].n_recs;
+   return( n_found);
 }
 
 static int err_exit( void)
@@ -57,7 +247,18 @@ static int err_exit( void)
            "the 'large' MPC files UnnObs.txt, CmtObs.txt, SatObs.txt,\n"
            "NumObs.txt,  and itf.txt.  For example:\n\n"
            "./mpc_extr UnnObs.txt K14A00A K13YD3F\n\n"
-           "would output all records for 2014 AA and 2013 YF133 to stdout.\n");
+           "would output all records for 2014 AA and 2013 YF133 to stdout.\n\n"
+           "./mpc_extr NumObs.txt,UnnObs.txt K14A00A\n\n"
+           "would search both files,  merging the results.  '-a' in place of\n"
+           "the file name(s) searches NumObs,  UnnObs,  CmtObs and itf.txt.\n\n"
+           "./mpc_extr UnnObs.txt -index\n\n"
+           "would write an index,  UnnObs.txt.idx,  to speed up later extractions.\n\n"
+           "-l(file)   Read designations from (file),  one per line (stdin\n"
+           "           if no file is given),  and extract them in file order.\n"
+           "-p(prefix) Write each object's records to (prefix)(desig).txt.\n"
+           "-o(file)   Write records to (file) instead of stdout.\n"
+           "-d(socket) Run as a daemon,  answering queries on a Unix socket.\n"
+           "-c(socket) (in place of the file name) Get records from a daemon.\n");
    return( -1);
 }
 
@@ -82,70 +283,638 @@ static void convert_to_packed( char *packed, const char *ibuff)
    *packed = '\0';
 }
 
-int main( const int argc, const char **argv)
+/* Targets are kept in this form,  already packed.  */
+
+typedef char target_t[16];
+
+static void set_target( target_t target, const char *desig)
+{
+   if( atoi( desig) > 1800)
+      convert_to_packed( target, desig);
+   else
+      snprintf( target, sizeof( target_t), "%s", desig);
+}
+
+static void add_target( target_t **targets, unsigned long *n_targets,
+                        const char *desig)
 {
-   FILE *ifile;
-   unsigned long n_recs, recsize;
+   if( !(*n_targets % 1024))
+      *targets = (target_t *)realloc( *targets,
+                           (*n_targets + 1024) * sizeof( target_t));
+   set_target( (*targets)[*n_targets], desig);
+   (*n_targets)++;
+}
+
+/* Reads designations,  one per line,  from a file (or from stdin if the
+file name is empty or '-').  Blank lines and lines starting with '#' are
+skipped,  as is anything after the first word on a line.  */
+
+static int read_target_list( target_t **targets, unsigned long *n_targets,
+                        const char *filename)
+{
+   const int use_stdin = (!*filename || !strcmp( filename, "-"));
+   FILE *ifile = (use_stdin ? stdin : fopen( filename, "rb"));
+   char buff[100], desig[20];
+
+   if( !ifile)
+      {
+      perror( filename);
+      return( -1);
+      }
+   while( fgets( buff, sizeof( buff), ifile))
+      if( *buff != '#' && sscanf( buff, "%19s", desig) == 1)
+         add_target( targets, n_targets, desig);
+   if( !use_stdin)
+      fclose( ifile);
+   return( 0);
+}
+
+/* Puts targets in the order in which they'd appear in the file.  Five-
+character (numbered) targets are matched against columns 1-5,  seven-
+character ones against columns 6-12 (see mpc_compare()),  so the two
+kinds are kept in separate groups,  and each group is sorted.  */
+
+static int target_compare( const void *a, const void *b)
+{
+   const char *str1 = (const char *)a, *str2 = (const char *)b;
+   const size_t len1 = strlen( str1), len2 = strlen( str2);
+
+   if( len1 != len2)
+      return( len1 < len2 ? -1 : 1);
+   return( strcmp( str1, str2));
+}
+
+/* Up to MAX_FILES files can be searched at once.  The search thread for
+each fills in the first record and number of records for each target.  */
+
+#define MAX_FILES 20
+
+typedef struct
+{
+   mapped_file_t mf, idx_map;
+   idx_header_t hdr;
+   const idx_entry_t *entries;      /* NULL if there's no usable index */
+   unsigned long recsize, n_recs;
+   const target_t *targets;
+   unsigned long n_targets, *first, *count;
+   struct stat st, idx_st;          /* to tell if either's been replaced */
+} obs_file_t;
+
+static void get_idx_stat( struct stat *st, const char *filename)
+{
+   char idx_name[300];
+
+   snprintf( idx_name, sizeof( idx_name), "%.280s.idx", filename);
+   if( stat( idx_name, st))         /* no index:  leave the stat zeroed */
+      memset( st, 0, sizeof( struct stat));
+}
+
+static int open_obs_file( obs_file_t *f, const char *filename)
+{
+   const char *tptr;
+
+   memset( f, 0, sizeof( obs_file_t));
+   if( stat( filename, &f->st) || map_file( &f->mf, filename, 0))
+      return( -1);
+   get_idx_stat( &f->idx_st, filename);
+   tptr = (const char *)memchr( f->mf.data, '\n', f->mf.len);
+   f->recsize = (tptr ? (unsigned long)( tptr - f->mf.data) + 1
+                      : (unsigned long)f->mf.len);
+   f->n_recs = (f->recsize ? (unsigned long)f->mf.len / f->recsize : 0);
+   if( f->n_recs)
+      f->entries = load_index( &f->idx_map, &f->hdr, filename, f->recsize);
+   return( 0);
+}
+
+static void close_obs_file( obs_file_t *f)
+{
+   if( f->entries)
+      unmap_file( &f->idx_map);
+   unmap_file( &f->mf);
+   free( f->first);
+   free( f->count);
+}
+
+static const char *record( const obs_file_t *f, const unsigned long rec)
+{
+   return( f->mf.data + rec * f->recsize);
+}
+
+/* Returns the first record at or after 'lo' that doesn't sort before
+'target',  or n_recs if there is no such record.  All records before
+'lo' must sort before 'target'.  We 'gallop' out from 'lo' in steps of
+1, 2, 4, 8... until we overshoot,  then binary-search the last step.  If
+the previous target ended at 'lo' and this one isn't far past it,  that
+takes only a few probes (usually in the same page),  so walking a sorted
+list of targets costs about one sequential pass through the file.  With
+lo = 0,  this is an ordinary binary search,  give or take a probe. */
+
+static unsigned long gallop_search( const obs_file_t *f, const char *target,
+                  unsigned long lo)
+{
+   unsigned long hi, step = 1;
+
+   if( lo >= f->n_recs)
+      return( f->n_recs);
+   if( mpc_compare( record( f, lo), target) >= 0)
+      return( lo);
+   for( ;;)
+      {
+      hi = lo + step;
+      if( hi >= f->n_recs)
+         {
+         hi = f->n_recs;
+         break;
+         }
+      if( mpc_compare( record( f, hi), target) >= 0)
+         break;
+      lo = hi;
+      step <<= 1;
+      }
+   while( hi - lo > 1)        /* record 'lo' < target <= record 'hi' */
+      {
+      const unsigned long mid = lo + (hi - lo) / 2;
+
+      if( mpc_compare( record( f, mid), target) < 0)
+         lo = mid;
+      else
+         hi = mid;
+      }
+   return( hi);
+}
+
+/* Sets *loc to the first record for 'target' and returns the number of
+records.  Without an index,  the search starts at *loc (see above).  */
+
+static unsigned long find_object( const obs_file_t *f, const char *target,
+                                  unsigned long *loc)
+{
+   unsigned long n_found = 0;
+
+   if( f->entries)
+      return( index_lookup( f->entries, (unsigned long)f->hdr.n_entries,
+                                 target, loc));
+   *loc = gallop_search( f, target, *loc);
+   while( *loc + n_found < f->n_recs
+               && !mpc_compare( record( f, *loc + n_found), target))
+      n_found++;
+   return( n_found);
+}
+
+static void *search_file( void *context)
+{
+   obs_file_t *f = (obs_file_t *)context;
+   unsigned long t, loc = 0;
+
+   for( t = 0; t < f->n_targets; t++)
+      {        /* continue from the last hit if targets are in order */
+               /* and of the same kind.  Numbered targets sort after    */
+               /* provisional ones,  but in the file,  records with a   */
+               /* blank number come first;  so start over if it changes */
+      if( !t || strlen( f->targets[t - 1]) != strlen( f->targets[t])
+             || target_compare( f->targets[t - 1], f->targets[t]) >= 0)
+         loc = 0;
+      f->count[t] = find_object( f, f->targets[t], &loc);
+      f->first[t] = loc;
+      loc += f->count[t];
+      }
+   return( NULL);
+}
+
+/* Writes out all records for target 't' from all files.  Each file's
+records are already in order,  so we just do a merge,  taking the
+record from the earliest file in case of a tie.  */
+
+static unsigned long write_object( const obs_file_t *files, const int n_files,
+                  const unsigned long t, FILE *ofile)
+{
+   unsigned long pos[MAX_FILES], n_written = 0;
+   int i;
+
+   for( i = 0; i < n_files; i++)
+      pos[i] = 0;
+   for( ;;)
+      {
+      int best = -1;
+
+      for( i = 0; i < n_files; i++)
+         if( pos[i] < files[i].count[t])
+            if( best < 0 || mpc_line_compare(
+                        record( files + i, files[i].first[t] + pos[i]),
+                        record( files + best, files[best].first[t] + pos[best])) < 0)
+               best = i;
+      if( best < 0)
+         break;
+      fwrite( record( files + best, files[best].first[t] + pos[best]),
+                              files[best].recsize, 1, ofile);
+      pos[best]++;
+      n_written++;
+      }
+   return( n_written);
+}
+
+#ifndef _WIN32
+#define DEFAULT_SOCKET "/tmp/mpc_extr.sock"
+
+static int open_socket( const char *path, const int is_server)
+{
+   struct sockaddr_un addr;
+   const int fd = socket( AF_UNIX, SOCK_STREAM, 0);
+
+   if( fd < 0)
+      return( -1);
+   memset( &addr, 0, sizeof( addr));
+   addr.sun_family = AF_UNIX;
+   strncpy( addr.sun_path, path, sizeof( addr.sun_path) - 1);
+   if( is_server)
+      {
+      unlink( path);
+      if( bind( fd, (struct sockaddr *)&addr, sizeof( addr)) || listen( fd, 16))
+         {
+         close( fd);
+         return( -1);
+         }
+      }
+   else if( connect( fd, (struct sockaddr *)&addr, sizeof( addr)))
+      {
+      close( fd);
+      return( -1);
+      }
+   return( fd);
+}
+
+static int stat_changed( const struct stat *st0, const struct stat *st1)
+{
+   return( st0->st_ino != st1->st_ino || st0->st_dev != st1->st_dev
+            || st0->st_size != st1->st_size || st0->st_mtime != st1->st_mtime);
+}
+
+/* The index is only good for the data file it was made from,  so if
+either the file or its index has been replaced (different inode) or
+modified,  we map both anew,  then drop the old mappings.  If the new
+file can't be mapped (or has vanished),  we keep serving the old data.  */
+
+static int obs_file_changed( const obs_file_t *f, const char *filename)
+{
+   struct stat st, idx_st;
+
+   if( stat( filename, &st))
+      return( 0);
+   get_idx_stat( &idx_st, filename);
+   return( stat_changed( &st, &f->st) || stat_changed( &idx_st, &f->idx_st));
+}
+
+static void refresh_obs_file( obs_file_t *f, const char *filename)
+{
+   obs_file_t new_f;
+
+   if( !obs_file_changed( f, filename) || open_obs_file( &new_f, filename))
+      return;
+   close_obs_file( f);
+   *f = new_f;
+   fprintf( stderr, "'%s' changed;  re-mapped it%s\n", filename,
+                     (f->entries ? " and its index" : ""));
+}
+
+/* Each connection gets its own thread,  so a client that sits idle
+(or is slow to read its results) doesn't hold up anyone else.  The
+threads share the mapped files;  a read lock is held while searching
+them,  and a write lock while re-mapping them.  Results are gathered
+in memory,  so the read lock isn't held while writing to the socket. */
+
+typedef struct
+{
+   obs_file_t *files;
+   char (*filenames)[256];
+   int n_files;
+   pthread_rwlock_t lock;
+} daemon_t;
+
+typedef struct
+{
+   daemon_t *daemon;
+   int fd;
+} connection_t;
+
+static void refresh_obs_files( daemon_t *d)
+{
+   int i, changed = 0;
+
+   pthread_rwlock_rdlock( &d->lock);
+   for( i = 0; i < d->n_files; i++)
+      if( obs_file_changed( d->files + i, d->filenames[i]))
+         changed = 1;
+   pthread_rwlock_unlock( &d->lock);
+   if( changed)
+      {
+      pthread_rwlock_wrlock( &d->lock);
+      for( i = 0; i < d->n_files; i++)
+         refresh_obs_file( d->files + i, d->filenames[i]);
+      pthread_rwlock_unlock( &d->lock);
+      }
+}
+
+/* Searches all files for 'desig',  and writes the records found to a
+malloced buffer.  Returns its length,  or (size_t)-1 on failure.  */
+
+static size_t find_in_files( daemon_t *d, const char *desig, char **buff)
+{
+   obs_file_t files[MAX_FILES];
+   unsigned long first[MAX_FILES], count[MAX_FILES];
+   target_t target;
+   size_t len = 0;
+   FILE *ofile;
+   int i;
+
+   *buff = NULL;
+   set_target( target, desig);
+   refresh_obs_files( d);
+   ofile = open_memstream( buff, &len);
+   if( !ofile)
+      return( (size_t)-1);
+   pthread_rwlock_rdlock( &d->lock);
+   for( i = 0; i < d->n_files; i++)
+      {
+      files[i] = d->files[i];     /* own copy of the search results */
+      files[i].targets = (const target_t *)&target;
+      files[i].n_targets = 1;
+      files[i].first = first + i;
+      files[i].count = count + i;
+      search_file( files + i);
+      }
+   write_object( files, d->n_files, 0, ofile);
+   pthread_rwlock_unlock( &d->lock);
+   fclose( ofile);
+   return( len);
+}
+
+static void *serve_connection( void *context)
+{
+   connection_t *conn = (connection_t *)context;
+   FILE *ifile = fdopen( conn->fd, "rb");
+   FILE *ofile = fdopen( dup( conn->fd), "wb");
+   char buff[100], desig[16];
+
+   while( ifile && ofile && fgets( buff, sizeof( buff), ifile))
+      if( sscanf( buff, "%15s", desig) == 1)
+         {
+         char *results;
+         const size_t len = find_in_files( conn->daemon, desig, &results);
+
+         if( len != (size_t)-1)
+            fwrite( results, len, 1, ofile);
+         free( results);
+         fputc( '\n', ofile);
+         if( fflush( ofile))
+            break;
+         }
+   if( ifile)
+      fclose( ifile);
+   else
+      close( conn->fd);
+   if( ofile)
+      fclose( ofile);
+   free( conn);
+   return( NULL);
+}
+
+static int run_daemon( obs_file_t *files, char filenames[][256],
+                  const int n_files, const char *socket_path)
+{
+   const int listen_fd = open_socket( socket_path, 1);
+   daemon_t d;
+   pthread_attr_t attr;
+
+   if( listen_fd < 0)
+      {
+      perror( socket_path);
+      return( -1);
+      }
+   signal( SIGPIPE, SIG_IGN);       /* clients may hang up on us */
+   d.files = files;
+   d.filenames = filenames;
+   d.n_files = n_files;
+   pthread_rwlock_init( &d.lock, NULL);
+   pthread_attr_init( &attr);
+   pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED);
+   printf( "Serving %d file(s) on '%s'\n", n_files, socket_path);
+   fflush( stdout);
+   for( ;;)
+      {
+      const int fd = accept( listen_fd, NULL, NULL);
+      connection_t *conn;
+      pthread_t thread;
+
+      if( fd < 0)
+         continue;
+      conn = (connection_t *)malloc( sizeof( connection_t));
+      if( !conn)
+         {
+         close( fd);
+         continue;
+         }
+      conn->daemon = &d;
+      conn->fd = fd;
+      if( pthread_create( &thread, &attr, serve_connection, conn))
+         serve_connection( conn);      /* no thread;  do it ourselves */
+      }
+   return( 0);
+}
+
+/* 'mpc_extr -c(socket) desig desig...'  sends the designations to a
+running daemon,  and writes out what comes back,  just as if mpc_extr
+had searched the files itself.  */
+
+static int run_client( const int argc, const char **argv)
+{
+   const char *socket_path = (argv[1][2] ? argv[1] + 2 : DEFAULT_SOCKET);
+   const int fd = open_socket( socket_path, 0);
+   target_t *targets = NULL;
+   unsigned long n_targets = 0, t;
+   FILE *ifile, *ofile;
    char buff[100];
-   int compare, i;
+   int i;
+
+   if( fd < 0)
+      {
+      perror( socket_path);
+      return( -1);
+      }
+   for( i = 2; i < argc; i++)
+      if( argv[i][0] != '-')
+         add_target( &targets, &n_targets, argv[i]);
+      else if( argv[i][1] == 'l')
+         {
+         if( read_target_list( &targets, &n_targets, argv[i] + 2))
+            return( -1);
+         }
+      else
+         printf( "Unrecognized command-line option '%s'\n", argv[i]);
+   ifile = fdopen( fd, "rb");
+   ofile = fdopen( dup( fd), "wb");
+   for( t = 0; t < n_targets; t++)
+      {
+      int n_found = 0;
+
+      fprintf( ofile, "%s\n", targets[t]);
+      fflush( ofile);
+      while( fgets( buff, sizeof( buff), ifile) && *buff != '\n')
+         {
+         printf( "%s", buff);
+         n_found++;
+         }
+      printf( "%d records found for '%s'\n", n_found, targets[t]);
+      }
+   fclose( ifile);
+   fclose( ofile);
+   free( targets);
+   return( 0);
+}
+#endif
+
+int main( const int argc, const char **argv)
+{
+   unsigned long n_targets = 0, t;
+   int i, n_files = 0, sort_targets = 0, make_index = 0;
    FILE *ofile = stdout;
+   const char *per_object_prefix = NULL, *socket_path = NULL;
+   const char *file_list = argv[1];
+   const int use_all = (argc > 1 && !strcmp( argv[1], "-a"));
+   char filenames[MAX_FILES][256];
+   obs_file_t files[MAX_FILES];
+   pthread_t threads[MAX_FILES];
+   char started[MAX_FILES];
+   target_t *targets = NULL;
 
    if( argc < 3)
       return( err_exit( ));
-   ifile = fopen( argv[1], "rb");
-   if( !ifile)
+#ifndef _WIN32
+   if( !memcmp( argv[1], "-c", 2))
+      return( run_client( argc, argv));
+#endif
+   if( use_all)
+      file_list = "NumObs.txt,UnnObs.txt,CmtObs.txt,itf.txt";
+   while( *file_list && n_files < MAX_FILES)
       {
-      printf( "%s not opened : ", argv[1]);
-      fflush( stdout);
-      perror( "");
-      return( err_exit( ));
+      size_t len = strcspn( file_list, ",");
+
+      if( len > 255)
+         len = 255;
+      memcpy( filenames[n_files], file_list, len);
+      filenames[n_files][len] = '\0';
+      file_list += strcspn( file_list, ",");
+      if( *file_list)
+         file_list++;
+      if( !open_obs_file( files + n_files, filenames[n_files]))
+         n_files++;
+      else if( use_all)
+         fprintf( stderr, "%s not found;  skipping it\n", filenames[n_files]);
+      else
+         {
+         printf( "%s not opened : ", filenames[n_files]);
+         fflush( stdout);
+         perror( "");
+         return( err_exit( ));
+         }
       }
-   err_fgets( buff, sizeof( buff), ifile);
-   recsize = strlen( buff);
-   fseek( ifile, 0L, SEEK_END);
-   n_recs = ftell( ifile) / recsize;
+   if( !n_files)
+      return( err_exit( ));
    for( i = 2; i < argc; i++)
       if( argv[i][0] == '-')
          switch( argv[i][1])
             {
+#ifndef _WIN32
+            case 'd':
+               socket_path = (argv[i][2] ? argv[i] + 2 : DEFAULT_SOCKET);
+               break;
+#endif
+            case 'i':
+               if( !strcmp( argv[i], "-index"))
+                  make_index = 1;
+               else
+                  printf( "Unrecognized command-line option '%s'\n", argv[i]);
+               break;
+            case 'l':
+               if( read_target_list( &targets, &n_targets, argv[i] + 2))
+                  return( -1);
+               sort_targets = 1;
+               break;
             case 'o':
                ofile = fopen( argv[i] + 2, "wb");
                break;
+            case 'p':
+               per_object_prefix = argv[i] + 2;
+               break;
             default:
                printf( "Unrecognized command-line option '%s'\n", argv[i]);
                break;
             }
-   for( i = 2; i < argc; i++)
-      if( argv[i][0] != '-')
+      else
+         add_target( &targets, &n_targets, argv[i]);
+   if( make_index)
+      {
+      int rval = 0;
+
+      for( i = 0; i < n_files; i++)
+         if( write_index( files[i].mf.data, filenames[i],
+                              files[i].recsize, files[i].n_recs))
+            rval = -1;
+      return( rval);
+      }
+#ifndef _WIN32
+   if( socket_path)
+      return( run_daemon( files, filenames, n_files, socket_path));
+#endif
+   if( sort_targets)
+      qsort( targets, n_targets, sizeof( target_t), target_compare);
+   for( i = 0; i < n_files; i++)
+      {
+      files[i].targets = (const target_t *)targets;
+      files[i].n_targets = n_targets;
+      files[i].first = (unsigned long *)calloc( n_targets + 1, sizeof( unsigned long));
+      files[i].count = (unsigned long *)calloc( n_targets + 1, sizeof( unsigned long));
+      if( !files[i].first || !files[i].count)
          {
-         unsigned long loc = 0, step, loc1;
-         int n_found = 0;
-         char target[50];
-
-         if( atoi( argv[i]) > 1800)
-            convert_to_packed( target, argv[i]);
-         else
-            strcpy( target, argv[i]);
-         for( step = 0x8000000; step; step >>= 1)
-            if( (loc1 = loc + step) < n_recs)
-               {
-               fseek( ifile, loc1 * recsize, SEEK_SET);
-               err_fgets( buff, sizeof( buff), ifile);
-               if( mpc_compare( buff, target) < 0)
-                  loc = loc1;
-               }
-         compare = -1;
-         fseek( ifile, loc * recsize, SEEK_SET);
-         while( compare <= 0 && fgets( buff, sizeof( buff), ifile))
+         fprintf( stderr, "Out of memory\n");
+         return( -1);
+         }
+      }
+   for( i = 0; i < n_files; i++)        /* one search thread per file */
+      {
+      started[i] = (n_files > 1 &&
+               !pthread_create( threads + i, NULL, search_file, files + i));
+      if( !started[i])
+         search_file( files + i);
+      }
+   for( i = 0; i < n_files; i++)
+      if( started[i])
+         pthread_join( threads[i], NULL);
+   for( t = 0; t < n_targets; t++)
+      {
+      const char *target = targets[t];
+      FILE *obj_file = ofile;
+      unsigned long n_found;
+
+      if( per_object_prefix)
+         {
+         char filename[300];
+
+         snprintf( filename, sizeof( filename), "%s%s.txt",
+                              per_object_prefix, target);
+         obj_file = fopen( filename, "wb");
+         if( !obj_file)
             {
-            compare = mpc_compare( buff, target);
-            if( !compare)
-               {
-               fprintf( ofile, "%s", buff);
-               n_found++;
-               }
+            perror( filename);
+            return( -1);
             }
-         printf( "%d records found for '%s'\n", n_found, target);
          }
+      n_found = write_object( files, n_files, t, obj_file);
+      if( obj_file != ofile)
+         fclose( obj_file);
+      printf( "%d records found for '%s'\n", (int)n_found, target);
+      }
+   for( i = 0; i < n_files; i++)
+      close_obs_file( files + i);
+   free( targets);
    return( 0);
 }
@@ -0,0 +1,116 @@
+/* Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA. */
+
+#include <string.h>
+#include <ctype.h>
+#include "mpc_key.h"
+
+/* Sort order for the large MPC astrometry files.  This used to be
+copied into 'fix_obs.c' and 'mpc_sort.cpp';  any code that sorts or
+merges such files should use this instead,  so they all agree.
+
+Some notes on the sort order for the MPC files:
+
+   -- Bill Zielenbach pointed out that the comparison goes beyond just the
+designation and the date/time.  If those are identical,  you need to look
+at the observation type (in column 15);  otherwise,  two-line observations
+(radar,  roving observer,  satellite) won't get sorted.  Also,  it does
+sometimes happen that the same object is observed simultaneously at two
+stations,  so the MPC code has to be compared.
+
+   -- 2001 QW322 is an unusual case.  It's the only binary TNO in the file,
+and has an a and a b component,  with the letter stuck between the year and
+month.  That gets you input such as
+
+     K01QW2W 5C2003a10 28.01437 20 40 46.15 -18 41 48.2                 k3026309
+     K01QW2W 5C2003b10 28.01437 20 40 45.98 -18 41 46.5                 k3026309
+
+   -- Numbered periodic comets (0001P,  etc.) are sorted by number only;
+any provisional designation in columns 6-12 is ignored,  and fragments
+(column 12) are sorted by date along with the rest of the comet,  only
+being compared after the date and note 2.  CmtObs.txt and SatObs.txt need
+the same rule for defunct ('D') and interstellar ('I') comets and for
+numbered natural satellites (J013S,  etc.),  so those are now treated the
+same way.  For them,  we also insist on digits in columns 2-4,  so that
+packed asteroid numbers past 619999 (~0AbD,  etc.) aren't mistaken for
+them.  ('P' is left as it was,  to keep the UnnObs.txt/NumObs.txt order
+unchanged.)  */
+
+static int is_permanent_comet_or_satellite( const char *a)
+{
+   if( a[4] == 'P')
+      return( memcmp( a, "    ", 4) != 0);
+   return( (a[4] == 'D' || a[4] == 'I' || a[4] == 'S')
+           && isdigit( (unsigned char)a[1]) && isdigit( (unsigned char)a[2])
+           && isdigit( (unsigned char)a[3]));
+}
+
+int mpc_line_compare( const void *aptr, const void *bptr)
+{
+   const char *a = (const char *)aptr;
+   const char *b = (const char *)bptr;
+   int rval = 0;
+
+   if( is_permanent_comet_or_satellite( a)
+               && is_permanent_comet_or_satellite( b))
+      rval = memcmp( a, b, 5);         /* compare permanent number only */
+   else
+      rval = memcmp( a, b, 12);        /* compare entire ID */
+   if( !rval)              /* same ID,  so compare by year */
+      rval = memcmp( a + 15, b + 15, 4);
+   if( !rval)              /* same year;  compare month/day */
+      rval = memcmp( a + 20, b + 20, 12);
+   if( !rval)              /* still the same;  compare by note 2 */
+      rval = (int)a[14] - (int)b[14];
+   if( !rval)           /* Still the same:  compare by comet component */
+      rval = (int)a[11] - (int)b[11];
+   if( !rval)
+      rval = (int)b[10] - (int)a[10];
+   if( !rval)              /* now compare by MPC code */
+      rval = memcmp( a + 77, b + 77, 3);
+   if( !rval)           /* Still the same:  compare by asteroid component */
+      rval = (int)a[19] - (int)b[19];
+   return( rval);
+}
+
+/* The key holds the fields mpc_line_compare() looks at,  in the order it
+looks at them.  For permanent comet/satellite numbers,  we blank out the
+rest of the designation.  Whether a record gets that treatment depends
+only on its first five bytes,  and two records that differ there are
+ordered by those bytes either way,  so this matches mpc_line_compare()
+even when only one of the two records is such an object.  Column 10 is
+compared in reverse order,  so we store its complement.   */
+
+void mpc_sort_key( char *key, const char *a)
+{
+   memcpy( key, a, 12);
+   if( is_permanent_comet_or_satellite( a))
+      memset( key + 5, ' ', 7);
+   memcpy( key + 12, a + 15, 4);          /* year */
+   memcpy( key + 16, a + 20, 12);         /* month/day */
+   key[28] = a[14];                       /* note 2 */
+   key[29] = a[11];                       /* comet component */
+   key[30] = (char)( 255 - (unsigned char)a[10]);
+   memcpy( key + 31, a + 77, 3);          /* MPC code */
+   key[34] = a[19];                       /* asteroid component */
+   key[35] = '\0';
+}
+
+int mpc_key_compare( const void *a, const void *b)
+{
+   return( memcmp( a, b, MPC_KEY_LEN));
+}
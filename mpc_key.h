@@ -0,0 +1,48 @@
+#ifndef MPC_KEY_H_INCLUDED
+#define MPC_KEY_H_INCLUDED
+
+/* mpc_key.h: header file for the sort order of MPC 80-column astrometry
+Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.    */
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* #ifdef __cplusplus */
+
+#define MPC_KEY_LEN 36
+
+   /* Compares two 80-column records in the order used by the MPC's
+      UnnObs.txt,  NumObs.txt,  CmtObs.txt,  and SatObs.txt.  Suitable
+      for passing to qsort() or parallel_sort(). */
+
+int mpc_line_compare( const void *a, const void *b);
+
+   /* Fills 'key' with MPC_KEY_LEN bytes such that memcmp()ing the keys
+      for two records gives the same sign as mpc_line_compare() would
+      for the records themselves.  */
+
+void mpc_sort_key( char *key, const char *line);
+
+   /* memcmp() of two keys,  in a form suitable for qsort(). */
+
+int mpc_key_compare( const void *a, const void *b);
+
+#ifdef __cplusplus
+}
+#endif  /* #ifdef __cplusplus */
+
+#endif  /* #ifndef MPC_KEY_H_INCLUDED */
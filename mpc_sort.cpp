@@ -18,38 +18,28 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include "mpc_key.h"
+#include "mapfile.h"
+#include "par_sort.h"
 
 /* Based largely on 'fix_obs',  but the _only_ thing it does is to test
 out the comparison function to make sure the input file is properly sorted.
-See notes from 'fix_obs.cpp'.  */
+See notes in 'mpc_key.c'.
 
-static int mpc_compare( const void *aptr, const void *bptr)
-{
-   const char *a = (const char *)aptr;
-   const char *b = (const char *)bptr;
-   int rval = 0;
-
-   if( a[4] == 'P' && b[4] == 'P'     /* compare permanent period comet desig */
-               && memcmp( a, "    ", 4) && memcmp( b, "    ", 4))
-      rval = memcmp( a, b, 4);
-   else
-      rval = memcmp( a, b, 12);        /* compare entire ID */
-   if( !rval)              /* same ID,  so compare by year */
-      rval = memcmp( a + 15, b + 15, 4);
-   if( !rval)              /* same year;  compare month/day */
-      rval = memcmp( a + 20, b + 20, 12);
-   if( !rval)              /* still the same;  compare by note 2 */
-      rval = (int)a[14] - (int)b[14];
-   if( !rval)           /* Still the same:  compare by comet component */
-      rval = (int)a[11] - (int)b[11];
-   if( !rval)
-      rval = (int)b[10] - (int)a[10];
-   if( !rval)              /* now compare by MPC code */
-      rval = memcmp( a + 77, b + 77, 3);
-   if( !rval)           /* Still the same:  compare by asteroid component */
-      rval = (int)a[19] - (int)b[19];
-   return( rval);
-}
+   The file is memory-mapped and cut into one chunk per thread (at line
+boundaries).  Each thread compares every line in its chunk to the line
+before it;  for the first line of a chunk,  that's the last line of the
+previous chunk,  so the boundaries get checked too.  The byte offset of
+each record that doesn't sort after its predecessor is written to stdout,  one
+per line,  in file order,  followed by a summary line starting with '#'.
+The return value is 0 if the file is sorted,  1 if it isn't.  Options :
+
+   -j N   Use N threads (default is one per processor)
+   -v     Also show the out-of-order pairs of lines (prefixed by '#')
+
+   As before,  a record that compares _equal_ to the one before it (an
+exact duplicate,  as far as sorting goes) is reported as well.  */
 
 #ifdef __GNUC__
 void err_exit( const char *message, const int error_code)  __attribute__ ((noreturn));
@@ -64,36 +54,172 @@ void err_exit( const char *message, const int error_code)
    exit( error_code);
 }
 
-static FILE *err_fopen( const char *filename, const char *permits)
+typedef struct
 {
-   FILE *rval = fopen( filename, permits);
+   const char *data;
+   size_t start, end, len;    /* 'start' and 'end' are at line starts */
+   size_t *offsets, n_found, n_lines;
+   int thread_started;
+} chunk_t;
 
-   if( !rval)
-      {
-      char buff[90];
+#define is_power_of_two( X)   (!((X) & ((X) - 1)))
 
-      snprintf( buff, sizeof( buff), "Couldn't open '%s'\n", filename);
-      err_exit( buff, -1);
+/* Lines may be short (the last one may lack a line feed,  for example).
+mpc_line_compare() looks at 80 bytes,  so such lines are copied to a
+blank-padded buffer first.  */
+
+static const char *full_line( const char *data, const size_t loc,
+                              const size_t line_len, char *buff)
+{
+   if( line_len >= 80)
+      return( data + loc);
+   memset( buff, ' ', 80);
+   memcpy( buff, data + loc, line_len);
+   return( buff);
+}
+
+static size_t next_line( const chunk_t *c, const size_t loc)
+{
+   const char *tptr = (const char *)memchr( c->data + loc, '\n', c->len - loc);
+
+   return( tptr ? (size_t)( tptr - c->data) + 1 : c->len);
+}
+
+static void *check_chunk( void *context)
+{
+   chunk_t *c = (chunk_t *)context;
+   size_t loc = c->start, prev = c->start, prev_len = 0;
+   char buff1[81], buff2[81];
+
+   if( loc)          /* find start of last line in previous chunk */
+      {
+      prev = loc - 1;
+      while( prev && c->data[prev - 1] != '\n')
+         prev--;
+      prev_len = loc - prev;
+      }
+   while( loc < c->end)
+      {
+      const size_t next = next_line( c, loc);
+
+      if( prev_len && mpc_line_compare(
+                           full_line( c->data, prev, prev_len, buff1),
+                           full_line( c->data, loc, next - loc, buff2)) >= 0)
+         {
+         c->n_found++;
+         if( is_power_of_two( c->n_found))
+            {
+            c->offsets = (size_t *)realloc( c->offsets,
+                                 2 * c->n_found * sizeof( size_t));
+            if( !c->offsets)
+               err_exit( "Out of memory\n", -2);
+            }
+         c->offsets[c->n_found - 1] = loc;
+         }
+      prev = loc;
+      prev_len = next - loc;
+      loc = next;
+      c->n_lines++;
       }
-   return( rval);
+   return( NULL);
 }
 
-int main( const int argc, const char **argv)
+static void show_line( const char *data, const size_t loc, const size_t len)
 {
-   FILE *ifile = err_fopen( argc == 1 ? "UnnObs.txt" : argv[1], "rb");
-   char iline[90], prev[90];
+   const char *tptr = (const char *)memchr( data + loc, '\n', len - loc);
+   const size_t line_len = (tptr ? (size_t)( tptr - data) : len) - loc;
 
-   if( !fgets( prev, sizeof( prev), ifile))
-      err_exit( "Read failure (1)\n", -2);
+   printf( "# %.*s\n", (int)line_len, data + loc);
+}
 
-   while( fgets( iline, sizeof( iline), ifile))
+int main( const int argc, const char **argv)
+{
+   const char *filename = "UnnObs.txt";
+   mapped_file_t mf;
+   chunk_t *chunks;
+   pthread_t *threads;
+   int i, n_threads = n_cpus_available( ), verbose = 0;
+   size_t n_found = 0, n_lines = 0, j;
+
+   for( i = 1; i < argc; i++)
+      if( argv[i][0] != '-')
+         {
+         if( i == 1 || argv[i - 1][0] != '-' || argv[i - 1][1] != 'j'
+                     || argv[i - 1][2])
+            filename = argv[i];
+         }
+      else switch( argv[i][1])
+         {
+         case 'j':
+            n_threads = atoi( argv[i][2] || i == argc - 1 ? argv[i] + 2 : argv[i + 1]);
+            break;
+         case 'v':
+            verbose = 1;
+            break;
+         default:
+            fprintf( stderr, "Unrecognized option '%s'\n", argv[i]);
+            return( -1);
+         }
+   if( n_threads < 1)
+      n_threads = 1;
+   if( map_file( &mf, filename, 0))
       {
-      const int compare = mpc_compare( prev, iline);
+      char buff[200];
 
-      if( compare >= 0)
-         printf( "Compare = %d\n%s%s\n", compare, prev, iline);
-      strcpy( prev, iline);
+      snprintf( buff, sizeof( buff), "Couldn't open '%s'\n", filename);
+      err_exit( buff, -1);
+      }
+   chunks = (chunk_t *)calloc( n_threads, sizeof( chunk_t));
+   threads = (pthread_t *)calloc( n_threads, sizeof( pthread_t));
+   if( !chunks || !threads)
+      err_exit( "Out of memory\n", -2);
+   for( i = 0; i < n_threads; i++)
+      {
+      chunks[i].data = mf.data;
+      chunks[i].len = mf.len;
+      if( i)
+         {
+         chunks[i].start = mf.len * (size_t)i / (size_t)n_threads;
+         if( chunks[i].start < chunks[i - 1].start)
+            chunks[i].start = chunks[i - 1].start;
+         else if( chunks[i].start && mf.data[chunks[i].start - 1] != '\n')
+            chunks[i].start = next_line( chunks + i, chunks[i].start);
+         chunks[i - 1].end = chunks[i].start;
+         }
+      }
+   chunks[n_threads - 1].end = mf.len;
+   for( i = 0; i < n_threads; i++)
+      if( !pthread_create( threads + i, NULL, check_chunk, chunks + i))
+         chunks[i].thread_started = 1;
+      else
+         check_chunk( chunks + i);
+   for( i = 0; i < n_threads; i++)
+      {
+      if( chunks[i].thread_started)
+         pthread_join( threads[i], NULL);
+      for( j = 0; j < chunks[i].n_found; j++)
+         {
+         const size_t loc = chunks[i].offsets[j];
+
+         printf( "%lu\n", (unsigned long)loc);
+         if( verbose)
+            {
+            size_t prev = loc - 1;
+
+            while( prev && mf.data[prev - 1] != '\n')
+               prev--;
+            show_line( mf.data, prev, mf.len);
+            show_line( mf.data, loc, mf.len);
+            }
+         }
+      n_found += chunks[i].n_found;
+      n_lines += chunks[i].n_lines;
+      free( chunks[i].offsets);
       }
-   fclose( ifile);
-   return( 0);
+   printf( "# %lu out-of-order or duplicate records found in %lu lines of '%s'\n",
+               (unsigned long)n_found, (unsigned long)n_lines, filename);
+   free( chunks);
+   free( threads);
+   unmap_file( &mf);
+   return( n_found ? 1 : 0);
 }
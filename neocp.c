@@ -191,6 +191,25 @@ size_t curl_buff_write( char *ptr, size_t size, size_t nmemb, void *context_ptr)
    return( bytes_to_write);
 }
 
+static void set_fetch_options( CURL *curl, const char *url,
+                               curl_buff_t *context, char *errbuf)
+{
+   curl_easy_setopt( curl, CURLOPT_URL, url);
+   curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, curl_buff_write);
+   curl_easy_setopt( curl, CURLOPT_WRITEDATA, context);
+   curl_easy_setopt( curl, CURLOPT_ERRORBUFFER, errbuf);
+   *errbuf = '\0';
+}
+
+static void show_fetch_error( const CURLcode res, const char *errbuf,
+                              const char *url)
+{
+   fprintf( stderr, "libcurl error %d occurred\n", res);
+   fprintf( stderr, "%s\n",
+                 (*errbuf ? errbuf : curl_easy_strerror( res)));
+   printf( "url %s\n", url);
+}
+
 static unsigned fetch_a_file( const char *url, char *obuff,
                               const size_t max_len)
 {
@@ -207,11 +226,7 @@ static unsigned fetch_a_file( const char *url, char *obuff,
       context.loc = 0;
       context.obuff = obuff;
       context.max_len = max_len;
-      curl_easy_setopt( curl, CURLOPT_URL, url);
-      curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, curl_buff_write);
-      curl_easy_setopt( curl, CURLOPT_WRITEDATA, &context);
-      curl_easy_setopt( curl, CURLOPT_ERRORBUFFER, errbuf);
-      *errbuf = '\0';
+      set_fetch_options( curl, url, &context, errbuf);
 #ifdef NOT_CURRENTLY_USED
       if( flags & 2)
          {
@@ -222,10 +237,7 @@ static unsigned fetch_a_file( const char *url, char *obuff,
       res = curl_easy_perform( curl);
       if( res)
          {
-         fprintf( stderr, "libcurl error %d occurred\n", res);
-         fprintf( stderr, "%s\n",
-                       (*errbuf ? errbuf : curl_easy_strerror( res)));
-         printf( "url %s\n", url);
+         show_fetch_error( res, errbuf, url);
          exit( -1);
          }
       curl_easy_cleanup( curl);
@@ -234,6 +246,65 @@ static unsigned fetch_a_file( const char *url, char *obuff,
    return( rval);
 }
 
+/* When many objects have changed,  fetching their astrometry one at a
+time means waiting out one round trip to MPC after another.  Instead,
+we use the curl 'multi' interface to have up to 'max_transfers' of them
+in flight at once,  each going into its own buffer.  The results are
+then handled in the original order,  just as if they'd been fetched
+sequentially.  */
+
+typedef struct
+{
+   CURL *curl;
+   curl_buff_t context;
+   CURLcode res;
+   char url[200], errbuf[CURL_ERROR_SIZE];
+} fetch_t;
+
+static void fetch_files( fetch_t *fetches, const unsigned n_fetches,
+                         const unsigned max_transfers)
+{
+   CURLM *multi = curl_multi_init( );
+   unsigned n_started = 0, n_running = 0;
+
+   assert( multi);
+   while( n_started < n_fetches || n_running)
+      {
+      CURLMsg *msg;
+      int still_running, n_msgs;
+
+      while( n_started < n_fetches && n_running < max_transfers)
+         {
+         fetch_t *f = fetches + n_started++;
+
+         f->curl = curl_easy_init( );
+         assert( f->curl);
+         set_fetch_options( f->curl, f->url, &f->context, f->errbuf);
+         curl_easy_setopt( f->curl, CURLOPT_PRIVATE, f);
+         curl_multi_add_handle( multi, f->curl);
+         n_running++;
+         }
+      curl_multi_perform( multi, &still_running);
+      while( (msg = curl_multi_info_read( multi, &n_msgs)) != NULL)
+         if( msg->msg == CURLMSG_DONE)
+            {
+            CURL *curl = msg->easy_handle;
+            const CURLcode res = msg->data.result;
+            fetch_t *f;
+
+            curl_easy_getinfo( curl, CURLINFO_PRIVATE, (char **)&f);
+            f->res = res;
+            curl_multi_remove_handle( multi, curl);
+            curl_easy_cleanup( curl);
+            f->curl = NULL;
+            n_running--;
+            }
+      if( n_running)
+         curl_multi_wait( multi, NULL, 0, 1000, NULL);
+      }
+   curl_multi_cleanup( multi);
+}
+
 /* Lines in the MPC's plaintext summary of which objects are currently on
    NEOCP,  https://www.minorplanetcenter.net/iau/NEO/neocp.txt,  have
    certain fixed traits.  In recent years,  they have always been 102
@@ -471,7 +542,7 @@ from before,  plus the new stuff we've written out to 'neocp.new'. */
 
 #define MAX_ILEN 81000
 
-static void show_differences( void)
+static void show_differences( const char *obs_url, const unsigned max_transfers)
 {
    unsigned n_before, n_after, i, j, n_new;
    struct neocp_summary *before = get_neocp_summary( "neocplst.txt", &n_before);
@@ -510,15 +581,30 @@ static void show_differences( void)
 
    if( n_new)
       {
-      char *tbuff = (char *)malloc( MAX_ILEN);
+      fetch_t *fetches = (fetch_t *)calloc( n_new, sizeof( fetch_t));
       FILE *new_fp;
 
+      assert( fetches);
+      for( i = j = 0; i < n_after; i++)
+         if( !after[i].exists_in_other_list)
+            {
+            fetch_t *f = fetches + j++;
+
+            snprintf( f->url, sizeof( f->url), "%s%s&obs=y",
+                                   obs_url, after[i].desig);
+            f->context.obuff = (char *)malloc( MAX_ILEN);
+            assert( f->context.obuff);
+            f->context.max_len = MAX_ILEN - 1;
+            }
+      assert( j == n_new);
+      fetch_files( fetches, n_new, max_transfers);
       printf( "New/changed objects :\n");
       new_fp = NULL;
       for( i = j = 0; i < n_after; i++)
          if( !after[i].exists_in_other_list)
             {
-            char url[200];
+            fetch_t *f = fetches + j;
+            char *tbuff = f->context.obuff;
             unsigned bytes_read, n_obs_previously = 0, k;
             unsigned n_lines_actually_read;
 
@@ -527,10 +613,12 @@ static void show_differences( void)
                   n_obs_previously = before[k].n_obs;
             printf( "   (%u) %s: %u obs (was %u)\n", ++j, after[i].desig,
                                 after[i].n_obs, n_obs_previously);
-            strcpy( url, "https://minorplanetcenter.net/cgi-bin/showobsorbs.cgi?Obj=");
-            strcat( url, after[i].desig);
-            strcat( url, "&obs=y");
-            bytes_read = fetch_a_file( url, tbuff, MAX_ILEN - 1);
+            if( f->res)
+               {
+               show_fetch_error( f->res, f->errbuf, f->url);
+               exit( -1);
+               }
+            bytes_read = (unsigned)f->context.loc;
             if( bytes_read < 79)
                {
                fprintf( stderr, "ERROR: only %u bytes read\n", bytes_read);
@@ -555,11 +643,12 @@ static void show_differences( void)
                assert( new_fp);
                fwrite( tbuff, bytes_read, 1, new_fp);
                }
+            free( tbuff);
             }
       if( new_fp)
          fclose( new_fp);
 
-      free( tbuff);
+      free( fetches);
       ifile = fopen( "neocp.new", "rb");
       if( ifile)              /* append "new" objects to neocp.tmp, */
          {                    /* skipping HTML stuff */
@@ -627,23 +716,40 @@ keep the existing neocp.txt and neocplst.txt files.         */
 
 int main( const int argc, const char **argv)
 {
-    unsigned bytes_read;
+    unsigned bytes_read, max_transfers = 8;
     int i;
     FILE *ofile;
     char *tbuff;
     const char *neocp_text_summary =
                      "https://www.minorplanetcenter.net/iau/NEO/neocp.txt";
+    const char *obs_url =
+                "https://minorplanetcenter.net/cgi-bin/showobsorbs.cgi?Obj=";
 
     printf( "Content-type: text/html\n\n");
     avoid_runaway_process( );
     for( i = 1; i < argc; i++)
        if( argv[i][0] == '-')
+          {
+          const char *arg = (argv[i][2] || i == argc - 1 ? argv[i] + 2 : argv[i + 1]);
+
           switch( argv[i][1])
              {
+             case 'c':      /* max number of simultaneous obs downloads */
+                max_transfers = (unsigned)atoi( arg);
+                if( !max_transfers)
+                   max_transfers = 1;
+                break;
+             case 's':      /* URLs can be replaced,  mostly for testing */
+                neocp_text_summary = arg;
+                break;
+             case 'u':
+                obs_url = arg;
+                break;
              default:
                 printf( "Command-line option '%s' unknown\n", argv[i]);
                 return( 0);
              }
+          }
 
 #ifdef CHECK_HEAD
                      /* just get the headers... not doing this at present */
@@ -667,7 +773,7 @@ int main( const int argc, const char **argv)
     assert( ofile);
     fwrite( tbuff, bytes_read, 1, ofile);
     fclose( ofile);
-    show_differences( );
+    show_differences( obs_url, max_transfers);
 
             /* If we got here,  everything worked.  So unlink the old */
             /* files and use the new ones :                           */
@@ -21,6 +21,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <stdint.h>
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
@@ -123,67 +125,6 @@ static void time_tag( char *tag)
    tag[4] = int_to_mutant_hex_char( tm.tm_min);
 }
 
-typedef struct
-{
-   char *obuff;
-   size_t loc, max_len;
-} curl_buff_t;
-
-size_t curl_buff_write( char *ptr, size_t size, size_t nmemb, void *context_ptr)
-{
-   curl_buff_t *context = (curl_buff_t *)context_ptr;
-   size_t bytes_to_write = size * nmemb;
-
-   if( bytes_to_write > context->max_len - context->loc)
-      bytes_to_write = context->max_len - context->loc;
-   memcpy( context->obuff + context->loc, ptr, bytes_to_write);
-   context->loc += bytes_to_write;
-   return( bytes_to_write);
-}
-
-static unsigned fetch_a_file( const char *url, char *obuff,
-                              const size_t max_len)
-{
-   CURL *curl = curl_easy_init();
-   unsigned rval = 0;
-
-   assert( curl);
-   if( curl)
-      {
-      CURLcode res;
-      curl_buff_t context;
-      char errbuf[CURL_ERROR_SIZE];
-
-      context.loc = 0;
-      context.obuff = obuff;
-      context.max_len = max_len;
-      curl_easy_setopt( curl, CURLOPT_URL, url);
-      curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, curl_buff_write);
-      curl_easy_setopt( curl, CURLOPT_WRITEDATA, &context);
-      curl_easy_setopt( curl, CURLOPT_ERRORBUFFER, errbuf);
-      *errbuf = '\0';
-#ifdef NOT_CURRENTLY_USED
-      if( flags & 2)
-         {
-         curl_easy_setopt( curl, CURLOPT_NOBODY, 1);
-         curl_easy_setopt( curl, CURLOPT_HEADER, 1);
-         }
-#endif
-      res = curl_easy_perform( curl);
-      if( res)
-         {
-         fprintf( stderr, "libcurl error %d occurred\n", res);
-         fprintf( stderr, "%s\n",
-                       (*errbuf ? errbuf : curl_easy_strerror( res)));
-         printf( "url %s\n", url);
-         exit( -1);
-         }
-      curl_easy_cleanup( curl);
-      rval = (unsigned)context.loc;
-      }
-   return( rval);
-}
-
 static bool is_valid_astrometry_line( const char *buff)
 {
    bool is_mpc_line = true;
@@ -207,60 +148,347 @@ static bool is_valid_astrometry_line( const char *buff)
    return( is_mpc_line);
 }
 
-#define MAX_ILEN 81000000
+/* Lines from the old neocp.txt are matched to lines in the new data
+on bytes 0-58 and 64-79 (i.e.,  all but the time tag).  To avoid comparing
+every old line to every new one,  the new lines are put into a hash table
+(open addressing,  kept at most half full) keyed on those bytes.  If
+several new lines have the same key,  the table holds the first of them,
+which is the one a linear search would have found.    */
 
-int main( const int argc, const char **argv)
+static bool neocp_lines_match( const char *line1, const char *line2)
 {
-   unsigned bytes_read, i, j, n_new_lines = 0, n_lines = 0;
-   int n_to_old = 0;
-   FILE *ofile, *ifile;
-   char *tbuff, buff[100], tag[6], old_neocp[12];
-   char **ilines;
-   const char *bulk_neocp_url =
-           "https://www.minorplanetcenter.net//cgi-bin/bulk_neocp.cgi?what=obs";
+   return( !memcmp( line1, line2, 59) && !memcmp( line1 + 64, line2 + 64, 16));
+}
 
-   printf( "Content-type: text/html\n\n");
-   avoid_runaway_process( );
-   for( i = 1; i < (unsigned)argc; i++)
-      if( argv[i][0] == '-')
-         switch( argv[i][1])
+static unsigned hash_neocp_line( const char *line)
+{
+   unsigned rval = 2166136261u;     /* FNV-1a */
+   size_t i;
+
+   for( i = 0; i < 80; i++)
+      if( i < 59 || i >= 64)
+         rval = (rval ^ (unsigned char)line[i]) * 16777619u;
+   return( rval);
+}
+
+/* The new data is parsed as it arrives,  rather than after the whole
+transfer :  curl hands us the data in chunks,  which are appended to a
+growable buffer.  As each line starts,  its offset is recorded;  once we
+have its 80 bytes,  it's added to the above hash table.  Offsets are
+used instead of pointers because the buffer moves as it grows.  We also
+keep a checksum of the data,  so that in polling mode,  we can tell if
+it's unchanged from the last download.  */
+
+typedef struct
+{
+   char *text;
+   size_t len, alloced;
+   size_t *line_start;
+   unsigned n_lines, lines_alloced, n_hashed;
+   unsigned *slots, table_size;
+   uint64_t checksum;
+} line_store_t;
+
+#define LINE_PTR( store, idx) ((store)->text + (store)->line_start[idx])
+
+static void add_to_line_hash( line_store_t *store, const unsigned idx)
+{
+   const char *line = LINE_PTR( store, idx);
+   unsigned loc = hash_neocp_line( line) & (store->table_size - 1);
+
+   while( store->slots[loc]
+             && !neocp_lines_match( LINE_PTR( store, store->slots[loc] - 1), line))
+      loc = (loc + 1) & (store->table_size - 1);
+   if( !store->slots[loc])        /* if it's a repeat,  keep the first one */
+      store->slots[loc] = idx + 1;
+}
+
+static void hash_pending_lines( line_store_t *store)
+{
+   while( store->n_hashed < store->n_lines
+               && LINE_PTR( store, store->n_hashed) + 80
+                                       <= store->text + store->len)
+      {
+      if( 2 * store->n_hashed >= store->table_size)
+         {
+         unsigned i;
+
+         store->table_size = (store->table_size ? store->table_size * 2 : 1024);
+         free( store->slots);
+         store->slots = (unsigned *)calloc( store->table_size, sizeof( unsigned));
+         assert( store->slots);
+         for( i = 0; i < store->n_hashed; i++)
+            add_to_line_hash( store, i);
+         }
+      add_to_line_hash( store, store->n_hashed++);
+      }
+}
+
+static void add_to_line_store( line_store_t *store, const char *data,
+                               const size_t n_bytes)
+{
+   size_t i;
+
+   if( store->len + n_bytes + 80 > store->alloced)
+      {                   /* extra 80 bytes for the zero-padding at the end */
+      while( store->len + n_bytes + 80 > store->alloced)
+         store->alloced = (store->alloced ? store->alloced * 2 : 65536);
+      store->text = (char *)realloc( store->text, store->alloced);
+      assert( store->text);
+      }
+   memcpy( store->text + store->len, data, n_bytes);
+   for( i = 0; i < n_bytes; i++)
+      store->checksum = (store->checksum ^ (unsigned char)data[i])
+                                    * (uint64_t)1099511628211u;
+   for( i = store->len; i < store->len + n_bytes; i++)
+      if( !i || store->text[i - 1] == 10)
+         {
+         if( store->n_lines == store->lines_alloced)
             {
-            case 'n':
-               bulk_neocp_url = NULL;
-               printf( "Working offline\n");
-               break;
-            default:
-               printf( "Command-line option '%s' unknown\n", argv[i]);
-               return( 0);
+            store->lines_alloced = (store->lines_alloced ?
+                                    store->lines_alloced * 2 : 1024);
+            store->line_start = (size_t *)realloc( store->line_start,
+                                 store->lines_alloced * sizeof( size_t));
+            assert( store->line_start);
             }
+         store->line_start[store->n_lines++] = i;
+         }
+   store->len += n_bytes;
+   hash_pending_lines( store);
+}
 
-   tbuff = (char *)malloc( MAX_ILEN);
-   if( bulk_neocp_url)
+/* At the end of the data,  a last line may be short of 80 bytes.  It
+gets compared to the old lines with zeroes filling out the rest.  */
+
+static void finish_line_store( line_store_t *store)
+{
+   if( !store->text)
       {
-      bytes_read = fetch_a_file( bulk_neocp_url, tbuff, MAX_ILEN);
-      ofile = err_fopen( "neocpnew.txt", "wb");
-      fwrite( tbuff, bytes_read, 1, ofile);
-      fclose( ofile);
+      store->alloced = 80;
+      store->text = (char *)malloc( store->alloced);
+      assert( store->text);
       }
-   else
+   memset( store->text + store->len, 0, 80);
+   store->len += 80;
+   hash_pending_lines( store);
+   store->len -= 80;
+}
+
+static void init_line_store( line_store_t *store)
+{
+   memset( store, 0, sizeof( line_store_t));
+   store->checksum = (uint64_t)14695981039346656037u;      /* FNV-1a */
+}
+
+static void free_line_store( line_store_t *store)
+{
+   free( store->text);
+   free( store->line_start);
+   free( store->slots);
+}
+
+/* Returns the index of the first new line matching 'buff',  or -1. */
+
+static int find_line( const line_store_t *store, const char *buff)
+{
+   unsigned loc;
+
+   if( !store->slots)
+      return( -1);
+   loc = hash_neocp_line( buff) & (store->table_size - 1);
+   while( store->slots[loc])
       {
-      ifile = err_fopen( "neocpnew.txt", "rb");
-      bytes_read = fread( tbuff, 1, MAX_ILEN, ifile);
-      fclose( ifile);
+      if( neocp_lines_match( LINE_PTR( store, store->slots[loc] - 1), buff))
+         return( (int)store->slots[loc] - 1);
+      loc = (loc + 1) & (store->table_size - 1);
       }
+   return( -1);
+}
+
+static size_t curl_line_store_write( char *ptr, size_t size, size_t nmemb,
+                                     void *context_ptr)
+{
+   add_to_line_store( (line_store_t *)context_ptr, ptr, size * nmemb);
+   return( size * nmemb);
+}
+
+/* In polling mode (see main()),  we keep the ETag and Last-Modified
+headers from the last download we actually processed,  and send them
+back as If-None-Match and If-Modified-Since.  If NEOCP hasn't changed,
+the server can then reply with a header-only '304 Not Modified'. */
+
+typedef struct
+{
+   char etag[200], last_modified[100];
+} validators_t;
+
+static void copy_header_value( char *obuff, const size_t obuff_size,
+                               const char *value, size_t len)
+{
+   while( len && (*value == ' ' || *value == '\t'))
+      {
+      value++;
+      len--;
+      }
+   while( len && (value[len - 1] == 10 || value[len - 1] == 13
+                              || value[len - 1] == ' '))
+      len--;
+   if( len < obuff_size)
+      {
+      memcpy( obuff, value, len);
+      obuff[len] = '\0';
+      }
+}
+
+static size_t curl_header_write( char *ptr, size_t size, size_t nmemb,
+                                 void *context_ptr)
+{
+   validators_t *received = (validators_t *)context_ptr;
+   const size_t len = size * nmemb;
+
+   if( len > 5 && !memcmp( ptr, "HTTP/", 5))    /* new response;  e.g., */
+      memset( received, 0, sizeof( validators_t));    /* after a redirect */
+   else if( len > 5 && !strncasecmp( ptr, "ETag:", 5))
+      copy_header_value( received->etag, sizeof( received->etag),
+                         ptr + 5, len - 5);
+   else if( len > 14 && !strncasecmp( ptr, "Last-Modified:", 14))
+      copy_header_value( received->last_modified,
+                         sizeof( received->last_modified), ptr + 14, len - 14);
+   return( len);
+}
+
+/* Returns the HTTP response code (zero for non-HTTP URLs),  or -1 if
+the transfer failed.  'sent' and 'received' may be NULL;  if not,  the
+validators in 'sent' are sent with the request,  and those in the
+response are stored in 'received'.  The curl handle is left open,  so
+that in polling mode,  the connection can be reused. */
+
+static long fetch_a_file( CURL *curl, const char *url, line_store_t *store,
+                          const validators_t *sent, validators_t *received)
+{
+   CURLcode res;
+   char errbuf[CURL_ERROR_SIZE], header[300];
+   struct curl_slist *headers = NULL;
+   long rval = 0;
+
+   curl_easy_setopt( curl, CURLOPT_URL, url);
+   curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, curl_line_store_write);
+   curl_easy_setopt( curl, CURLOPT_WRITEDATA, store);
+   curl_easy_setopt( curl, CURLOPT_ERRORBUFFER, errbuf);
+   if( sent && *sent->etag)
+      {
+      snprintf( header, sizeof( header), "If-None-Match: %s", sent->etag);
+      headers = curl_slist_append( headers, header);
+      }
+   if( sent && *sent->last_modified)
+      {
+      snprintf( header, sizeof( header), "If-Modified-Since: %s",
+                                          sent->last_modified);
+      headers = curl_slist_append( headers, header);
+      }
+   curl_easy_setopt( curl, CURLOPT_HTTPHEADER, headers);
+   if( received)
+      {
+      memset( received, 0, sizeof( validators_t));
+      curl_easy_setopt( curl, CURLOPT_HEADERFUNCTION, curl_header_write);
+      curl_easy_setopt( curl, CURLOPT_HEADERDATA, received);
+      }
+   *errbuf = '\0';
+#ifdef NOT_CURRENTLY_USED
+   if( flags & 2)
+      {
+      curl_easy_setopt( curl, CURLOPT_NOBODY, 1);
+      curl_easy_setopt( curl, CURLOPT_HEADER, 1);
+      }
+#endif
+   res = curl_easy_perform( curl);
+   curl_easy_setopt( curl, CURLOPT_HTTPHEADER, NULL);
+   curl_slist_free_all( headers);
+   if( res)
+      {
+      fprintf( stderr, "libcurl error %d occurred\n", res);
+      fprintf( stderr, "%s\n",
+                    (*errbuf ? errbuf : curl_easy_strerror( res)));
+      printf( "url %s\n", url);
+      return( -1);
+      }
+   curl_easy_getinfo( curl, CURLINFO_RESPONSE_CODE, &rval);
+   finish_line_store( store);
+   return( rval);
+}
+
+/* For neocp.new,  we need all lines for each new/updated object.  The
+lines are linked by designation (columns 1-12) :  first[i] is the index
+of the first line with the same designation as line i,  and next[i] is
+one more than the index of the following such line (zero at the end of
+the list).  Lists are in file order.  This uses a hash table as above,
+with each slot holding one more than the index of the last line found
+so far for that designation.   */
+
+static unsigned hash_desig( const char *line)
+{
+   unsigned rval = 2166136261u;     /* FNV-1a */
+   size_t i;
+
+   for( i = 0; i < 12; i++)
+      rval = (rval ^ (unsigned char)line[i]) * 16777619u;
+   return( rval);
+}
+
+static void link_lines_by_desig( char **ilines, const unsigned n_lines,
+                                 unsigned *first, unsigned *next)
+{
+   unsigned table_size = 1024, *slots, i;
+
+   while( table_size < 2 * n_lines)
+      table_size <<= 1;
+   slots = (unsigned *)calloc( table_size, sizeof( unsigned));
+   assert( slots);
+   for( i = 0; i < n_lines; i++)
+      {
+      unsigned loc = hash_desig( ilines[i]) & (table_size - 1);
+
+      while( slots[loc] && memcmp( ilines[slots[loc] - 1], ilines[i], 12))
+         loc = (loc + 1) & (table_size - 1);
+      next[i] = 0;
+      if( slots[loc])
+         {
+         const unsigned last = slots[loc] - 1;
+
+         next[last] = i + 1;
+         first[i] = first[last];
+         }
+      else
+         first[i] = i;
+      slots[loc] = i + 1;
+      }
+   free( slots);
+}
+
+/* Given the new NEOCP data,  updates neocp.txt,  neocp.old,  and
+neocp.new as described at top.  Returns -1 if the data is bad.  */
+
+static int update_neocp_files( line_store_t *store)
+{
+   unsigned bytes_read, i, j, n_new_lines = 0, n_lines = 0;
+   unsigned *first, *next;
+   int n_to_old = 0;
+   FILE *ofile, *ifile;
+   char *tbuff, buff[100], tag[6], old_neocp[12];
+   char **ilines;
+
+   tbuff = store->text;
+   bytes_read = (unsigned)store->len;
    printf( "%u bytes read; %u lines\n", bytes_read, bytes_read / 81U);
    if( bytes_read % 81)
       {
       printf( "NOT A MULTIPLE OF 81\n");
       return( -1);
       }
-   for( i = n_lines = 0; i < bytes_read; i++)
-      if( !i || tbuff[i - 1] == 10)
-         n_lines++;
+   n_lines = store->n_lines;
    ilines = (char **)calloc( n_lines + 1, sizeof( char *));
-   for( i = n_lines = 0; i < bytes_read; i++)
-      if( !i || tbuff[i - 1] == 10)
-         ilines[n_lines++] = tbuff + i;
+   for( i = 0; i < n_lines; i++)
+      ilines[i] = LINE_PTR( store, i);
 
    ifile = err_fopen( "neocp.txt", "rb");
    ofile = err_fopen( "neocp.old", "ab");
@@ -268,16 +496,11 @@ int main( const int argc, const char **argv)
    while( fgets( buff, sizeof( buff), ifile))
       if( is_valid_astrometry_line( buff))
          {
-         bool match_found = false;
+         const int idx = find_line( store, buff);
 
-         for( i = 0; !match_found && ilines[i]; i++)
-            if( !memcmp( ilines[i], buff, 59) &&
-                           !memcmp( ilines[i] + 64, buff + 64, 16))
-               {
-               match_found = true;
-               memcpy( ilines[i] + 59, buff + 59, 5);
-               }
-         if( !match_found)
+         if( idx >= 0)
+            memcpy( ilines[idx] + 59, buff + 59, 5);
+         else
             {
             if( !n_to_old)
                {
@@ -311,33 +534,155 @@ int main( const int argc, const char **argv)
    fwrite( tbuff, bytes_read, 1, ofile);
    fclose( ofile);
 
+   first = (unsigned *)malloc( 2 * n_lines * sizeof( unsigned) + 1);
+   assert( first);
+   next = first + n_lines;
+   link_lines_by_desig( ilines, n_lines, first, next);
    ofile = NULL;
    j = (unsigned)-1;
    for( i = 0; ilines[i]; i++)
       if( !memcmp( ilines[i] + 59, tag, 5))
          if( j == (unsigned)-1 || memcmp( ilines[i], ilines[j], 12))
             {
-            unsigned n_lines_out = 0, n_prev = 0;
+            unsigned n_lines_out = 0, n_prev = 0, k;
 
             if( !ofile)
                {
                printf( "New/updated objects\n");
                ofile = err_fopen( "neocp.new", "wb");
                }
-            for( j = 0; ilines[j]; j++)
-               if( !memcmp( ilines[i], ilines[j], 12))
-                  {
-                  fprintf( ofile, "%.80s\n", ilines[j]);
-                  n_lines_out++;
-                  if( memcmp( ilines[j] + 59, tag, 5))
-                     n_prev++;
-                  }
+            for( k = first[i] + 1; k; k = next[k - 1])
+               {
+               fprintf( ofile, "%.80s\n", ilines[k - 1]);
+               n_lines_out++;
+               if( memcmp( ilines[k - 1] + 59, tag, 5))
+                  n_prev++;
+               }
             j = i;
             printf( "%.12s  %u obs written (was %u)\n", ilines[i], n_lines_out, n_prev);
             }
    if( ofile)
       fclose( ofile);
-   free( tbuff);
+   free( first);
    free( ilines);
-   return 0;
+   return( 0);
+}
+
+static void write_neocpnew( const line_store_t *store)
+{
+   FILE *ofile = err_fopen( "neocpnew.txt", "wb");
+
+   fwrite( store->text, store->len, 1, ofile);
+   fclose( ofile);
+}
+
+/* With -p(seconds),  we poll NEOCP indefinitely,  reusing one curl
+handle (and therefore,  usually,  one connection).  A poll is skipped
+without further ado if the server says the data isn't modified (which
+requires it to support ETags or Last-Modified),  or if what we got has
+the same checksum as the last data we processed.  -u(url) replaces the
+NEOCP URL;  this is mostly so we can test against a local server.  */
+
+int main( const int argc, const char **argv)
+{
+   line_store_t store;
+   int i, poll_seconds = 0, rval = 0;
+   const char *bulk_neocp_url =
+           "https://www.minorplanetcenter.net//cgi-bin/bulk_neocp.cgi?what=obs";
+
+   printf( "Content-type: text/html\n\n");
+   for( i = 1; i < argc; i++)
+      if( argv[i][0] == '-')
+         {
+         const char *arg = (argv[i][2] || i == argc - 1 ? argv[i] + 2 : argv[i + 1]);
+
+         switch( argv[i][1])
+            {
+            case 'n':
+               bulk_neocp_url = NULL;
+               printf( "Working offline\n");
+               break;
+            case 'p':
+               poll_seconds = atoi( arg);
+               break;
+            case 'u':
+               bulk_neocp_url = arg;
+               break;
+            default:
+               printf( "Command-line option '%s' unknown\n", argv[i]);
+               return( 0);
+            }
+         }
+   if( !bulk_neocp_url)
+      poll_seconds = 0;
+   if( !poll_seconds)         /* a poller is _supposed_ to run forever */
+      avoid_runaway_process( );
+
+   init_line_store( &store);
+   if( poll_seconds)
+      {
+      CURL *curl = curl_easy_init( );
+      validators_t sent, received;
+      uint64_t last_checksum = 0;
+      bool have_checksum = false;
+
+      assert( curl);
+      memset( &sent, 0, sizeof( sent));
+      for( ;;)
+         {
+         const time_t t0 = time( NULL);
+         long response;
+
+         printf( "Polling at %.24s UTC\n", asctime( gmtime( &t0)));
+         response = fetch_a_file( curl, bulk_neocp_url, &store,
+                                  &sent, &received);
+         if( response == 304)
+            printf( "Not modified\n");
+         else if( response != 200 && response != 0)
+            printf( "Fetch failed (%ld)\n", response);
+         else if( have_checksum && store.checksum == last_checksum)
+            {
+            printf( "Unchanged\n");
+            sent = received;
+            }
+         else
+            {
+            write_neocpnew( &store);
+            if( !update_neocp_files( &store))
+               {
+               sent = received;
+               last_checksum = store.checksum;
+               have_checksum = true;
+               }
+            }
+         free_line_store( &store);
+         init_line_store( &store);
+         fflush( stdout);
+         sleep( (unsigned)poll_seconds);
+         }
+      }
+   if( bulk_neocp_url)
+      {
+      CURL *curl = curl_easy_init( );
+
+      assert( curl);
+      if( fetch_a_file( curl, bulk_neocp_url, &store, NULL, NULL) < 0)
+         exit( -1);
+      curl_easy_cleanup( curl);
+      write_neocpnew( &store);
+      }
+   else
+      {
+      FILE *ifile = err_fopen( "neocpnew.txt", "rb");
+      char chunk[65536];
+      size_t bytes_read;
+
+      while( (bytes_read = fread( chunk, 1, sizeof( chunk), ifile)) > 0)
+         add_to_line_store( &store, chunk, bytes_read);
+      fclose( ifile);
+      finish_line_store( &store);
+      }
+   rval = update_neocp_files( &store);
+   free_line_store( &store);
+   return( rval);
 }
@@ -0,0 +1,237 @@
+/* Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "obs_zblk.h"
+
+/* The MPC astrometry files are highly redundant (the same packed ID on
+line after line,  the same station codes,  dates differing only in the
+last few digits),  and compress four- to sixfold with zlib.  But a file
+compressed as a single stream has to be decompressed from the start to
+get at any one object.  So here,  the records are cut into blocks of about
+64 KBytes,  each compressed separately.  An index at the end of the file
+gives each block's offset,  size,  and the first and last packed IDs in it.
+Finding an object is then a binary search of the index,  plus decompressing
+the one block (occasionally more) holding that object's records.
+
+   File layout :  a zobs_header_t,  then the compressed blocks,  then
+n_blocks zobs_block_t structures starting at 'index_offset'.  All in
+native byte order.   */
+
+#define ZOBS_MAGIC "MPCZBLK"
+#define BLOCK_SIZE 65536
+
+/* Same matching rule as mpc_compare() in mpc_extr.cpp : a five-character
+target is compared to columns 1-5 (numbered objects),  otherwise to
+columns 6-12 (provisional designations).  */
+
+static int target_compare( const char *id, const char *target)
+{
+   if( strlen( target) == 5)
+      return( memcmp( id, target, 5));
+   else
+      return( memcmp( id + 5, target, 7));
+}
+
+int zobs_compress( const char *ifilename, const char *ofilename,
+                                 const int level)
+{
+   mapped_file_t mf;
+   zobs_header_t hdr;
+   zobs_block_t *blocks;
+   FILE *ofile;
+   const char *tptr;
+   unsigned char *obuff;
+   uLongf obuff_size;
+   uint64_t i, offset = sizeof( zobs_header_t);
+   int rval = -3;             /* compression failed,  unless we get through */
+
+   if( map_file( &mf, ifilename, 0))
+      return( -1);
+   memset( &hdr, 0, sizeof( hdr));
+   memcpy( hdr.magic, ZOBS_MAGIC, sizeof( hdr.magic));
+   tptr = (mf.len ? (const char *)memchr( mf.data, '\n', mf.len) : NULL);
+   hdr.recsize = (uint32_t)( tptr ? tptr - mf.data + 1 : 81);
+   hdr.recs_per_block = BLOCK_SIZE / hdr.recsize;
+   hdr.n_recs = mf.len / hdr.recsize;
+   hdr.n_blocks = (hdr.n_recs + hdr.recs_per_block - 1) / hdr.recs_per_block;
+   obuff_size = compressBound( hdr.recs_per_block * hdr.recsize);
+   obuff = (unsigned char *)malloc( obuff_size);
+   blocks = (zobs_block_t *)calloc( hdr.n_blocks + 1, sizeof( zobs_block_t));
+         /* only create the output once we know we can go ahead */
+   ofile = (obuff && blocks && hdr.recsize >= 12 ? fopen( ofilename, "wb")
+                                                 : NULL);
+   if( !ofile)
+      {
+      free( obuff);
+      free( blocks);
+      unmap_file( &mf);
+      return( -2);
+      }
+   fwrite( &hdr, sizeof( hdr), 1, ofile);
+   for( i = 0; i < hdr.n_blocks; i++)
+      {
+      zobs_block_t *b = blocks + i;
+      const char *recs;
+      uLongf out_len = obuff_size;
+
+      b->first_rec = i * hdr.recs_per_block;
+      b->n_recs = hdr.recs_per_block;
+      if( b->first_rec + b->n_recs > hdr.n_recs)
+         b->n_recs = (uint32_t)( hdr.n_recs - b->first_rec);
+      recs = mf.data + b->first_rec * hdr.recsize;
+      memcpy( b->first_id, recs, 12);
+      memcpy( b->last_id, recs + (b->n_recs - 1) * hdr.recsize, 12);
+      if( compress2( obuff, &out_len, (const Bytef *)recs,
+                     b->n_recs * hdr.recsize, level) != Z_OK)
+         break;
+      b->offset = offset;
+      b->compressed_size = (uint32_t)out_len;
+      fwrite( obuff, out_len, 1, ofile);
+      offset += out_len;
+      }
+   hdr.index_offset = offset;
+   if( i == hdr.n_blocks)
+      {
+      fwrite( blocks, sizeof( zobs_block_t), (size_t)hdr.n_blocks, ofile);
+      fseek( ofile, 0L, SEEK_SET);
+      fwrite( &hdr, sizeof( hdr), 1, ofile);
+      rval = (ferror( ofile) ? -4 : 0);      /* e.g.,  disk full */
+      }
+   if( fclose( ofile) && !rval)
+      rval = -4;
+   free( obuff);
+   free( blocks);
+   unmap_file( &mf);
+   if( rval)         /* don't leave a partial file with no index */
+      remove( ofilename);
+   return( rval);
+}
+
+int zobs_open( zobs_t *z, const char *filename)
+{
+   memset( z, 0, sizeof( zobs_t));
+   if( map_file( &z->mf, filename, 0))
+      return( -1);
+   if( z->mf.len >= sizeof( zobs_header_t))
+      memcpy( &z->hdr, z->mf.data, sizeof( zobs_header_t));
+   if( z->mf.len < sizeof( zobs_header_t)
+               || memcmp( z->hdr.magic, ZOBS_MAGIC, 8)
+               || z->hdr.index_offset + z->hdr.n_blocks * sizeof( zobs_block_t)
+                              != z->mf.len)
+      {
+      unmap_file( &z->mf);
+      return( -2);
+      }
+            /* the index isn't necessarily aligned within the file,  so */
+            /* we make an aligned copy of it: */
+   z->blocks = (zobs_block_t *)malloc( (size_t)z->hdr.n_blocks
+                                     * sizeof( zobs_block_t) + 1);
+   z->buff = (char *)malloc( z->hdr.recs_per_block * z->hdr.recsize + 1);
+   if( !z->blocks || !z->buff)
+      {
+      zobs_close( z);
+      return( -3);
+      }
+   memcpy( z->blocks, z->mf.data + z->hdr.index_offset,
+               (size_t)z->hdr.n_blocks * sizeof( zobs_block_t));
+   z->curr_block = z->hdr.n_blocks;       /* i.e.,  nothing decompressed */
+   return( 0);
+}
+
+void zobs_close( zobs_t *z)
+{
+   free( z->blocks);
+   free( z->buff);
+   unmap_file( &z->mf);
+   memset( z, 0, sizeof( zobs_t));
+}
+
+const char *zobs_block( zobs_t *z, const uint64_t block)
+{
+   if( block >= z->hdr.n_blocks)
+      return( NULL);
+   if( block != z->curr_block)
+      {
+      const zobs_block_t *b = z->blocks + block;
+      uLongf out_len = z->hdr.recs_per_block * z->hdr.recsize;
+
+      z->curr_block = z->hdr.n_blocks;
+      if( b->offset + b->compressed_size > z->hdr.index_offset
+               || uncompress( (Bytef *)z->buff, &out_len,
+                  (const Bytef *)z->mf.data + b->offset, b->compressed_size) != Z_OK
+               || out_len != (uLongf)b->n_recs * z->hdr.recsize)
+         return( NULL);
+      z->curr_block = block;
+      }
+   return( z->buff);
+}
+
+long zobs_extract( zobs_t *z, const char *target, FILE *ofile)
+{
+   uint64_t lo = 0, hi = z->hdr.n_blocks;
+   long n_found = 0;
+
+   while( lo < hi)      /* find first block that could hold the target */
+      {
+      const uint64_t mid = (lo + hi) / 2;
+
+      if( target_compare( z->blocks[mid].last_id, target) < 0)
+         lo = mid + 1;
+      else
+         hi = mid;
+      }
+   while( lo < z->hdr.n_blocks
+                  && target_compare( z->blocks[lo].first_id, target) <= 0)
+      {
+      const char *recs = zobs_block( z, lo);
+      uint32_t i;
+
+      if( !recs)
+         return( -1);
+      for( i = 0; i < z->blocks[lo].n_recs; i++)
+         {
+         const char *rec = recs + i * z->hdr.recsize;
+
+         if( !target_compare( rec, target))
+            {
+            fwrite( rec, z->hdr.recsize, 1, ofile);
+            n_found++;
+            }
+         }
+      lo++;
+      }
+   return( n_found);
+}
+
+int zobs_write_all( zobs_t *z, FILE *ofile)
+{
+   uint64_t i;
+
+   for( i = 0; i < z->hdr.n_blocks; i++)
+      {
+      const char *recs = zobs_block( z, i);
+
+      if( !recs)
+         return( -1);
+      fwrite( recs, z->hdr.recsize, z->blocks[i].n_recs, ofile);
+      }
+   return( 0);
+}
@@ -0,0 +1,85 @@
+#ifndef OBS_ZBLK_H_INCLUDED
+#define OBS_ZBLK_H_INCLUDED
+
+/* obs_zblk.h: header file for block-compressed MPC astrometry files
+Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.    */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "mapfile.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* #ifdef __cplusplus */
+
+typedef struct
+   {
+   char magic[8];
+   uint32_t recsize, recs_per_block;
+   uint64_t n_recs, n_blocks, index_offset;
+   } zobs_header_t;
+
+typedef struct
+   {
+   char first_id[12], last_id[12];     /* packed IDs,  columns 1-12 */
+   uint64_t offset, first_rec;
+   uint32_t compressed_size, n_recs;
+   } zobs_block_t;
+
+typedef struct
+   {
+   mapped_file_t mf;
+   zobs_header_t hdr;
+   zobs_block_t *blocks;
+   char *buff;                /* the most recently decompressed block */
+   uint64_t curr_block;
+   } zobs_t;
+
+   /* zobs_compress() converts an 80-column file (sorted by packed ID,
+      as are NumObs.txt,  UnnObs.txt,  etc.) into the compressed form.
+      'level' is the zlib compression level (1-9).  Returns 0 on success;
+      if compression (-3) or writing (-4) fails,  the partial output file
+      is removed.
+      zobs_open() likewise returns 0 on success.  */
+
+int zobs_compress( const char *ifilename, const char *ofilename,
+                                 const int level);
+int zobs_open( zobs_t *z, const char *filename);
+void zobs_close( zobs_t *z);
+
+   /* Returns a pointer to the decompressed records of the given block,
+      or NULL if the block is out of range or corrupted.  */
+
+const char *zobs_block( zobs_t *z, const uint64_t block);
+
+   /* Writes out the records for 'target' (five characters for a numbered
+      object,  seven for a provisional designation;  see mpc_extr.cpp),
+      decompressing only the blocks that might contain it.  Returns the
+      number of records written,  or -1 on error.  */
+
+long zobs_extract( zobs_t *z, const char *target, FILE *ofile);
+
+   /* Decompresses the entire file;  returns 0 on success. */
+
+int zobs_write_all( zobs_t *z, FILE *ofile);
+
+#ifdef __cplusplus
+}
+#endif  /* #ifdef __cplusplus */
+
+#endif  /* #ifndef OBS_ZBLK_H_INCLUDED */
@@ -0,0 +1,96 @@
+/* Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "obs_zblk.h"
+
+/* Converts the large MPC astrometry files (NumObs.txt,  UnnObs.txt,
+etc.) to and from a block-compressed form (see obs_zblk.c),  and
+extracts objects from the compressed files in the manner of mpc_extr.  */
+
+static int error_exit( void)
+{
+   printf( "obs_zip compresses MPC 80-column astrometry files into a form\n"
+           "that still allows quick extraction of individual objects.\n\n"
+           "./obs_zip -c UnnObs.txt UnnObs.zob   compresses UnnObs.txt;\n"
+           "./obs_zip -x UnnObs.zob              decompresses it to stdout;\n"
+           "./obs_zip UnnObs.zob K14A00A K13YD3F writes all records for\n"
+           "       2014 AA and 2013 YF133 to stdout.\n\n"
+           "-1 through -9 set the compression level (default 9).\n");
+   return( -1);
+}
+
+int main( const int argc, const char **argv)
+{
+   const char *filenames[2];
+   int i, n_files = 0, compress = 0, level = 9, rval = 0;
+   zobs_t z;
+
+   if( argc < 3)
+      return( error_exit( ));
+   for( i = 1; i < argc; i++)
+      if( argv[i][0] == '-')
+         switch( argv[i][1])
+            {
+            case 'c':
+               compress = 1;
+               break;
+            case 'x':
+               break;
+            default:
+               if( argv[i][1] >= '1' && argv[i][1] <= '9')
+                  level = argv[i][1] - '0';
+               else
+                  printf( "Unrecognized command-line option '%s'\n", argv[i]);
+               break;
+            }
+      else if( n_files < 2)
+         filenames[n_files++] = argv[i];
+   if( compress)
+      {
+      if( n_files < 2)
+         return( error_exit( ));
+      rval = zobs_compress( filenames[0], filenames[1], level);
+      if( rval)
+         fprintf( stderr, "Couldn't compress '%s' to '%s' (%d)\n",
+                        filenames[0], filenames[1], rval);
+      return( rval);
+      }
+   if( !n_files || zobs_open( &z, filenames[0]))
+      {
+      fprintf( stderr, "Couldn't open '%s'\n", n_files ? filenames[0] : "");
+      return( error_exit( ));
+      }
+   if( n_files == 1)
+      rval = zobs_write_all( &z, stdout);
+   else
+      for( i = 2; i < argc; i++)
+         if( argv[i][0] != '-' && argv[i] != filenames[0])
+            {
+            const long n_found = zobs_extract( &z, argv[i], stdout);
+
+            if( n_found < 0)
+               rval = -1;
+            printf( "%ld records found for '%s'\n", n_found, argv[i]);
+            }
+   if( rval)
+      fprintf( stderr, "'%s' is corrupted\n", filenames[0]);
+   zobs_close( &z);
+   return( rval);
+}
@@ -0,0 +1,319 @@
+/* Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "par_sort.h"
+
+#ifdef _WIN32
+   #include <windows.h>
+#else
+   #include <unistd.h>
+#endif
+
+/* Multi-threaded merge sort,  meant for the large MPC files (ten million
+or more 80-column records,  or arrays of sort keys built from them).
+
+   The array is cut into one slice per thread,  and each thread sorts its
+slice.  We then do log2(n_threads) rounds of merging,  ping-ponging
+between the array and a scratch buffer.  If we simply had one thread per
+pair of runs,  the last round would be a single merge on a single thread.
+So instead,  each pair's output is cut into pieces;  for each piece,  a
+binary search (co_rank() below) tells us how many elements come from each
+of the two runs,  and the pieces can then be merged independently.  Every
+round therefore keeps all threads busy.
+
+   Slices are sorted with our own merge sort rather than qsort(),  which
+isn't guaranteed to be stable (glibc's usually is,  but falls back to
+quicksort if it can't get memory,  and other libraries differ).  With
+every merge taking the left element on ties,  the result is then the
+same for any number of threads.   */
+
+typedef int (*compare_fn)( const void *, const void *);
+
+typedef struct
+{
+   char *base;
+   const char *a, *b;         /* runs being merged (b_len == 0 for a copy) */
+   char *out;                 /* where the merged pair will go */
+   size_t n_elems, a_len, b_len, out_start, out_end, elem_size;
+   compare_fn compare;
+} sort_task_t;
+
+static void merge_runs( const char *a, size_t a_len, const char *b,
+            size_t b_len, char *out, const size_t sz, compare_fn compare)
+{
+   while( a_len && b_len)
+      {
+      if( compare( a, b) <= 0)
+         {
+         memcpy( out, a, sz);
+         a += sz;
+         a_len--;
+         }
+      else
+         {
+         memcpy( out, b, sz);
+         b += sz;
+         b_len--;
+         }
+      out += sz;
+      }
+   memcpy( out, a, a_len * sz);
+   memcpy( out + a_len * sz, b, b_len * sz);
+}
+
+/* Stable merge sort,  using a scratch buffer the size of the array :
+insertion sort for short runs,  then bottom-up merging.  */
+
+#define SHORT_RUN 16
+
+static void stable_sort( char *base, char *scratch, const size_t n_elems,
+                         const size_t sz, compare_fn compare)
+{
+   char *src = base, *dst = scratch, *tptr;
+   size_t i, j, k, width;
+
+   for( i = 0; i < n_elems; i += SHORT_RUN)
+      {
+      const size_t n = (n_elems - i < SHORT_RUN ? n_elems - i : SHORT_RUN);
+      char *run = base + i * sz;
+
+      for( j = 1; j < n; j++)
+         {
+         memcpy( scratch, run + j * sz, sz);
+         for( k = j; k && compare( run + (k - 1) * sz, scratch) > 0; k--)
+            ;
+         if( k != j)
+            {
+            memmove( run + (k + 1) * sz, run + k * sz, (j - k) * sz);
+            memcpy( run + k * sz, scratch, sz);
+            }
+         }
+      }
+   for( width = SHORT_RUN; width < n_elems; width *= 2)
+      {
+      for( i = 0; i < n_elems; i += 2 * width)
+         {
+         const size_t a_len = (n_elems - i < width ? n_elems - i : width);
+         const size_t b_len = (n_elems - i - a_len < width ?
+                                    n_elems - i - a_len : width);
+
+         merge_runs( src + i * sz, a_len, src + (i + a_len) * sz, b_len,
+                     dst + i * sz, sz, compare);
+         }
+      tptr = src;
+      src = dst;
+      dst = tptr;
+      }
+   if( src != base)
+      memcpy( base, src, n_elems * sz);
+}
+
+static void *sort_slice( void *context)
+{
+   sort_task_t *t = (sort_task_t *)context;
+
+   stable_sort( t->base, t->out, t->n_elems, t->elem_size, t->compare);
+   return( NULL);
+}
+
+/* Returns the number of elements from run 'a' among the first 'k'
+elements of the merged output,  with ties going to 'a'. */
+
+static size_t co_rank( const sort_task_t *t, const size_t k)
+{
+   const size_t sz = t->elem_size;
+   size_t lo = (k > t->b_len ? k - t->b_len : 0);
+   size_t hi = (k < t->a_len ? k : t->a_len);
+
+   while( lo < hi)
+      {
+      const size_t mid = (lo + hi) / 2;
+
+      if( t->compare( t->a + mid * sz, t->b + (k - 1 - mid) * sz) <= 0)
+         lo = mid + 1;
+      else
+         hi = mid;
+      }
+   return( lo);
+}
+
+static void *merge_piece( void *context)
+{
+   const sort_task_t *t = (const sort_task_t *)context;
+   const size_t sz = t->elem_size;
+   size_t i = co_rank( t, t->out_start);
+   size_t j = t->out_start - i;
+   const size_t i_end = co_rank( t, t->out_end);
+   const size_t j_end = t->out_end - i_end;
+   char *out = t->out + t->out_start * sz;
+
+   while( i < i_end && j < j_end)
+      {
+      if( t->compare( t->a + i * sz, t->b + j * sz) <= 0)
+         memcpy( out, t->a + (i++) * sz, sz);
+      else
+         memcpy( out, t->b + (j++) * sz, sz);
+      out += sz;
+      }
+   memcpy( out, t->a + i * sz, (i_end - i) * sz);
+   out += (i_end - i) * sz;
+   memcpy( out, t->b + j * sz, (j_end - j) * sz);
+   return( NULL);
+}
+
+/* Runs each task in its own thread.  If a thread can't be created,
+we just do that task in this thread. */
+
+static void run_tasks( sort_task_t *tasks, const int n_tasks,
+                           void *(*func)( void *))
+{
+   pthread_t *threads = (pthread_t *)calloc( n_tasks, sizeof( pthread_t));
+   char *started = (char *)calloc( n_tasks, 1);
+   int i;
+
+   for( i = 0; i < n_tasks; i++)
+      if( threads && started
+                  && !pthread_create( threads + i, NULL, func, tasks + i))
+         started[i] = 1;
+      else
+         func( tasks + i);
+   for( i = 0; i < n_tasks; i++)
+      if( started && started[i])
+         pthread_join( threads[i], NULL);
+   free( threads);
+   free( started);
+}
+
+int parallel_sort_with_buffer( void *base, void *buffer,
+              const size_t n_elems, const size_t elem_size,
+              int (*compare)( const void *, const void *), int n_threads)
+{
+   char *src = (char *)base, *dst, *scratch = (char *)buffer;
+   size_t *bounds, i;
+   sort_task_t *tasks;
+   int n_runs, n_tasks;
+
+   if( (size_t)n_threads > n_elems / 1024)   /* not worth it for tiny sorts */
+      n_threads = (int)( n_elems / 1024);
+   if( n_threads < 1)
+      n_threads = 1;
+   if( !buffer)
+      scratch = (char *)malloc( n_elems * elem_size + elem_size);
+   bounds = (size_t *)malloc( (n_threads + 1) * sizeof( size_t));
+   tasks = (sort_task_t *)calloc( 2 * n_threads + 1, sizeof( sort_task_t));
+   if( !scratch || !bounds || !tasks)
+      {
+      if( !buffer)
+         free( scratch);
+      free( bounds);
+      free( tasks);
+      qsort( base, n_elems, elem_size, compare);
+      return( 1);
+      }
+   if( n_threads == 1)
+      {
+      stable_sort( src, scratch, n_elems, elem_size, compare);
+      if( !buffer)
+         free( scratch);
+      free( bounds);
+      free( tasks);
+      return( 1);
+      }
+   for( i = 0; i <= (size_t)n_threads; i++)
+      bounds[i] = n_elems * i / (size_t)n_threads;
+   for( i = 0; i < (size_t)n_threads; i++)
+      {
+      tasks[i].base = src + bounds[i] * elem_size;
+      tasks[i].out = scratch + bounds[i] * elem_size;
+      tasks[i].n_elems = bounds[i + 1] - bounds[i];
+      tasks[i].elem_size = elem_size;
+      tasks[i].compare = compare;
+      }
+   run_tasks( tasks, n_threads, sort_slice);
+
+   dst = scratch;
+   n_runs = n_threads;
+   while( n_runs > 1)
+      {
+      const int n_pairs = (n_runs + 1) / 2;
+      int pieces_per_pair = n_threads / n_pairs, pair, piece;
+
+      if( pieces_per_pair < 1)
+         pieces_per_pair = 1;
+      n_tasks = 0;
+      for( pair = 0; pair < n_pairs; pair++)
+         {
+         const size_t start = bounds[pair * 2];
+         const size_t mid = bounds[pair * 2 + 1];
+         const size_t end = (pair * 2 + 2 <= n_runs ? bounds[pair * 2 + 2] : mid);
+         const int n_pieces = (end == mid ? 1 : pieces_per_pair);
+
+         for( piece = 0; piece < n_pieces; piece++)
+            {
+            sort_task_t *t = tasks + n_tasks++;
+
+            t->a = src + start * elem_size;
+            t->a_len = mid - start;
+            t->b = src + mid * elem_size;
+            t->b_len = end - mid;
+            t->out = dst + start * elem_size;
+            t->out_start = (end - start) * piece / n_pieces;
+            t->out_end = (end - start) * (piece + 1) / n_pieces;
+            t->elem_size = elem_size;
+            t->compare = compare;
+            }
+         }
+      run_tasks( tasks, n_tasks, merge_piece);
+      for( pair = 0; pair < n_pairs; pair++)
+         bounds[pair] = bounds[pair * 2];
+      bounds[n_pairs] = bounds[n_runs];
+      n_runs = n_pairs;
+      src = dst;
+      dst = (dst == scratch ? (char *)base : scratch);
+      }
+   if( src != (char *)base)
+      memcpy( base, src, n_elems * elem_size);
+   if( !buffer)
+      free( scratch);
+   free( bounds);
+   free( tasks);
+   return( n_threads);
+}
+
+int parallel_sort( void *base, const size_t n_elems, const size_t elem_size,
+              int (*compare)( const void *, const void *), int n_threads)
+{
+   return( parallel_sort_with_buffer( base, NULL, n_elems, elem_size,
+                                      compare, n_threads));
+}
+
+int n_cpus_available( void)
+{
+#ifdef _WIN32
+   SYSTEM_INFO info;
+
+   GetSystemInfo( &info);
+   return( (int)info.dwNumberOfProcessors);
+#else
+   const long rval = sysconf( _SC_NPROCESSORS_ONLN);
+
+   return( rval > 0 ? (int)rval : 1);
+#endif
+}
@@ -0,0 +1,58 @@
+#ifndef PAR_SORT_H_INCLUDED
+#define PAR_SORT_H_INCLUDED
+
+/* par_sort.h: header file for multi-threaded merge sort
+Copyright (C) 2018, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.    */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* #ifdef __cplusplus */
+
+   /* Replacement for qsort(),  with an added thread count.  The array
+      is split into one slice per thread;  each slice is merge-sorted,
+      and then the slices are merged in parallel.  The sort is stable
+      (elements that compare as equal keep their original order),  so
+      the result doesn't depend on the number of threads.
+
+      A scratch buffer the size of the array is needed.  If that can't
+      be allocated,  we fall back to qsort(),  which may not be stable.
+      Returns the number of threads actually used. */
+
+int parallel_sort( void *base, const size_t n_elems, const size_t elem_size,
+              int (*compare)( const void *, const void *), int n_threads);
+
+   /* Same,  but using a scratch buffer supplied by the caller,  at least
+      (n_elems + 1) * elem_size bytes.  (Or NULL,  to have one allocated.)
+      For callers that sort many arrays in turn and want to hold their
+      memory use steady,  rather than allocate and free each time. */
+
+int parallel_sort_with_buffer( void *base, void *buffer,
+              const size_t n_elems, const size_t elem_size,
+              int (*compare)( const void *, const void *), int n_threads);
+
+   /* Number of processors currently online,  or 1 if we can't tell. */
+
+int n_cpus_available( void);
+
+#ifdef __cplusplus
+}
+#endif  /* #ifdef __cplusplus */
+
+#endif  /* #ifndef PAR_SORT_H_INCLUDED */